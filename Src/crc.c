@@ -0,0 +1,180 @@
+/**
+ * @file    crc.c
+ * @brief   CRC-16/XMODEM engines used for the packet checks and the CRC-32
+ *          of the flashed image.
+ */
+
+#include "crc.h"
+#include "main.h"
+
+#if (CRC16_IMPL == CRC16_HW) || CRC32_HW
+/**
+ * @brief   Enables the CRC peripheral clock.
+ * @param   void
+ * @return  void
+ */
+void crc_init(void)
+{
+  __HAL_RCC_CRC_CLK_ENABLE();
+}
+#endif
+
+/* Software CRC-32, also the fallback of the fixed F1/L1 unit. */
+#if !CRC32_HW || !CRC_PROGRAMMABLE
+#define CRC32_SOFT 1
+
+/* crc32_table[i] = CRC-32 of the nibble i shifted through the register. */
+static const uint32_t crc32_table[16] = {
+    0x00000000u, 0x04C11DB7u, 0x09823B6Eu, 0x0D4326D9u,
+    0x130476DCu, 0x17C56B6Bu, 0x1A864DB2u, 0x1E475005u,
+    0x2608EDB8u, 0x22C9F00Fu, 0x2F8AD6D6u, 0x2B4BCB61u,
+    0x350C9B64u, 0x31CD86D3u, 0x3C8EA00Au, 0x384FBDBDu,
+};
+#endif
+
+#if (CRC16_IMPL == CRC16_HW)
+/* One byte into the data register, the access width is the amount of data
+ * shifted in. The host build maps it to its model of the unit. */
+#ifndef CRC_DR_BYTE
+#define CRC_DR_BYTE (*(__IO uint8_t *)&CRC->DR)
+#endif
+
+#elif (CRC16_IMPL == CRC16_TABLE)
+/* crc16_table[i] = CRC of the byte i shifted through the register. */
+static const uint16_t crc16_table[256] = {
+    0x0000u, 0x1021u, 0x2042u, 0x3063u, 0x4084u, 0x50A5u, 0x60C6u, 0x70E7u,
+    0x8108u, 0x9129u, 0xA14Au, 0xB16Bu, 0xC18Cu, 0xD1ADu, 0xE1CEu, 0xF1EFu,
+    0x1231u, 0x0210u, 0x3273u, 0x2252u, 0x52B5u, 0x4294u, 0x72F7u, 0x62D6u,
+    0x9339u, 0x8318u, 0xB37Bu, 0xA35Au, 0xD3BDu, 0xC39Cu, 0xF3FFu, 0xE3DEu,
+    0x2462u, 0x3443u, 0x0420u, 0x1401u, 0x64E6u, 0x74C7u, 0x44A4u, 0x5485u,
+    0xA56Au, 0xB54Bu, 0x8528u, 0x9509u, 0xE5EEu, 0xF5CFu, 0xC5ACu, 0xD58Du,
+    0x3653u, 0x2672u, 0x1611u, 0x0630u, 0x76D7u, 0x66F6u, 0x5695u, 0x46B4u,
+    0xB75Bu, 0xA77Au, 0x9719u, 0x8738u, 0xF7DFu, 0xE7FEu, 0xD79Du, 0xC7BCu,
+    0x48C4u, 0x58E5u, 0x6886u, 0x78A7u, 0x0840u, 0x1861u, 0x2802u, 0x3823u,
+    0xC9CCu, 0xD9EDu, 0xE98Eu, 0xF9AFu, 0x8948u, 0x9969u, 0xA90Au, 0xB92Bu,
+    0x5AF5u, 0x4AD4u, 0x7AB7u, 0x6A96u, 0x1A71u, 0x0A50u, 0x3A33u, 0x2A12u,
+    0xDBFDu, 0xCBDCu, 0xFBBFu, 0xEB9Eu, 0x9B79u, 0x8B58u, 0xBB3Bu, 0xAB1Au,
+    0x6CA6u, 0x7C87u, 0x4CE4u, 0x5CC5u, 0x2C22u, 0x3C03u, 0x0C60u, 0x1C41u,
+    0xEDAEu, 0xFD8Fu, 0xCDECu, 0xDDCDu, 0xAD2Au, 0xBD0Bu, 0x8D68u, 0x9D49u,
+    0x7E97u, 0x6EB6u, 0x5ED5u, 0x4EF4u, 0x3E13u, 0x2E32u, 0x1E51u, 0x0E70u,
+    0xFF9Fu, 0xEFBEu, 0xDFDDu, 0xCFFCu, 0xBF1Bu, 0xAF3Au, 0x9F59u, 0x8F78u,
+    0x9188u, 0x81A9u, 0xB1CAu, 0xA1EBu, 0xD10Cu, 0xC12Du, 0xF14Eu, 0xE16Fu,
+    0x1080u, 0x00A1u, 0x30C2u, 0x20E3u, 0x5004u, 0x4025u, 0x7046u, 0x6067u,
+    0x83B9u, 0x9398u, 0xA3FBu, 0xB3DAu, 0xC33Du, 0xD31Cu, 0xE37Fu, 0xF35Eu,
+    0x02B1u, 0x1290u, 0x22F3u, 0x32D2u, 0x4235u, 0x5214u, 0x6277u, 0x7256u,
+    0xB5EAu, 0xA5CBu, 0x95A8u, 0x8589u, 0xF56Eu, 0xE54Fu, 0xD52Cu, 0xC50Du,
+    0x34E2u, 0x24C3u, 0x14A0u, 0x0481u, 0x7466u, 0x6447u, 0x5424u, 0x4405u,
+    0xA7DBu, 0xB7FAu, 0x8799u, 0x97B8u, 0xE75Fu, 0xF77Eu, 0xC71Du, 0xD73Cu,
+    0x26D3u, 0x36F2u, 0x0691u, 0x16B0u, 0x6657u, 0x7676u, 0x4615u, 0x5634u,
+    0xD94Cu, 0xC96Du, 0xF90Eu, 0xE92Fu, 0x99C8u, 0x89E9u, 0xB98Au, 0xA9ABu,
+    0x5844u, 0x4865u, 0x7806u, 0x6827u, 0x18C0u, 0x08E1u, 0x3882u, 0x28A3u,
+    0xCB7Du, 0xDB5Cu, 0xEB3Fu, 0xFB1Eu, 0x8BF9u, 0x9BD8u, 0xABBBu, 0xBB9Au,
+    0x4A75u, 0x5A54u, 0x6A37u, 0x7A16u, 0x0AF1u, 0x1AD0u, 0x2AB3u, 0x3A92u,
+    0xFD2Eu, 0xED0Fu, 0xDD6Cu, 0xCD4Du, 0xBDAAu, 0xAD8Bu, 0x9DE8u, 0x8DC9u,
+    0x7C26u, 0x6C07u, 0x5C64u, 0x4C45u, 0x3CA2u, 0x2C83u, 0x1CE0u, 0x0CC1u,
+    0xEF1Fu, 0xFF3Eu, 0xCF5Du, 0xDF7Cu, 0xAF9Bu, 0xBFBAu, 0x8FD9u, 0x9FF8u,
+    0x6E17u, 0x7E36u, 0x4E55u, 0x5E74u, 0x2E93u, 0x3EB2u, 0x0ED1u, 0x1EF0u,
+};
+
+#elif (CRC16_IMPL == CRC16_NIBBLE)
+/* crc16_table[i] = CRC of the nibble i shifted through the register. */
+static const uint16_t crc16_table[16] = {
+    0x0000u, 0x1021u, 0x2042u, 0x3063u, 0x4084u, 0x50A5u, 0x60C6u, 0x70E7u,
+    0x8108u, 0x9129u, 0xA14Au, 0xB16Bu, 0xC18Cu, 0xD1ADu, 0xE1CEu, 0xF1EFu,
+};
+
+#elif (CRC16_IMPL != CRC16_BITWISE)
+#error "Invalid CRC16_IMPL!"
+#endif
+
+/**
+ * @brief   Calculates the CRC-16 over the input data.
+ * @param   crc:    Initial value (0 for a new XMODEM packet).
+ * @param   *data:  Array of the data which we want to calculate.
+ * @param   length: Size of the data.
+ * @return  crc: The updated CRC.
+ */
+uint16_t crc16_update(uint16_t crc, const uint8_t *data, uint32_t length)
+{
+#if (CRC16_IMPL == CRC16_HW)
+  /* 16 bit polynomial, no bit reversal, start from the given value. */
+  CRC->POL = 0x1021u;
+  CRC->INIT = crc;
+  CRC->CR = CRC_CR_POLYSIZE_0 | CRC_CR_RESET;
+
+  /* Byte writes until the data is word aligned (M0+ can't do unaligned). */
+  while (length && ((uintptr_t)data & 0x3u)) {
+    CRC_DR_BYTE = *data++;
+    length--;
+  }
+  /* The unit shifts in the MSB first, so swap to keep the byte order. */
+  while (length >= 4u) {
+    CRC->DR = __REV(*(const uint32_t *)data);
+    data += 4u;
+    length -= 4u;
+  }
+  while (length--) {
+    CRC_DR_BYTE = *data++;
+  }
+  crc = (uint16_t)CRC->DR;
+#else
+  while (length--) {
+#if (CRC16_IMPL == CRC16_TABLE)
+    crc = (crc << 8u) ^ crc16_table[(uint8_t)(crc >> 8u) ^ *data++];
+#elif (CRC16_IMPL == CRC16_NIBBLE)
+    uint8_t byte = *data++;
+    crc = (crc << 4u) ^ crc16_table[(crc >> 12u) ^ (byte >> 4u)];
+    crc = (crc << 4u) ^ crc16_table[(crc >> 12u) ^ (byte & 0x0Fu)];
+#else
+    crc = crc ^ ((uint16_t)*data++ << 8u);
+    for (uint8_t i = 0u; i < 8u; i++) {
+      if (crc & 0x8000u) {
+        crc = (crc << 1u) ^ 0x1021u;
+      } else {
+        crc = crc << 1u;
+      }
+    }
+#endif
+  }
+#endif
+  return crc;
+}
+
+/**
+ * @brief   Calculates the CRC-32 over whole words.
+ * @param   crc:    Initial value (CRC32_INIT for a new image).
+ * @param   *data:  Words which we want to calculate, word aligned.
+ * @param   words:  Number of words.
+ * @return  crc: The updated CRC.
+ */
+uint32_t crc32_update(uint32_t crc, const uint32_t *data, uint32_t words)
+{
+#if CRC32_HW
+#if !CRC_PROGRAMMABLE
+  /* Fixed unit without INIT register, it can only go on from its own state. */
+  if (CRC32_INIT == crc) {
+    CRC->CR = CRC_CR_RESET;
+  }
+  if (CRC->DR == crc)
+#else
+  CRC->POL = 0x04C11DB7u;
+  CRC->INIT = crc;
+  CRC->CR = CRC_CR_RESET;
+#endif
+  {
+    while (words--) {
+      CRC->DR = *data++;
+    }
+    return CRC->DR;
+  }
+#endif
+#if CRC32_SOFT
+  while (words--) {
+    crc ^= *data++;
+    for (uint8_t i = 0u; i < 8u; i++) {
+      crc = (crc << 4u) ^ crc32_table[crc >> 28u];
+    }
+  }
+  return crc;
+#endif
+}
@@ -0,0 +1,69 @@
+/**
+ * @file    crc.h
+ * @brief   CRC-16/XMODEM (CCITT polynomial 0x1021, init 0) engines.
+ *
+ *          The backend is selected at build time with CRC16_IMPL so every
+ *          target can trade flash for speed:
+ *            CRC16_BITWISE: 8 shift/xor steps per byte, no table.
+ *            CRC16_NIBBLE:  two lookups per byte, 32 byte table.
+ *            CRC16_TABLE:   one lookup per byte, 512 byte table.
+ *            CRC16_HW:      CRC peripheral with programmable polynomial
+ *                           (L0, L4, F3). Falls back to CRC16_NIBBLE on
+ *                           parts without one (F1, L1).
+ *
+ *          CRC-32/MPEG-2 (polynomial 0x04C11DB7, init 0xFFFFFFFF, MSB first,
+ *          no final xor) over whole little endian words, the native mode of
+ *          the CRC unit of every STM32, checks the flashed image.
+ */
+
+#ifndef CRC_H_
+#define CRC_H_
+
+#include <stdint.h>
+
+/* Available CRC-16 backends. */
+#define CRC16_BITWISE 0
+#define CRC16_NIBBLE  1
+#define CRC16_TABLE   2
+#define CRC16_HW      3
+
+/* CRC unit with programmable polynomial and initial value (POL, INIT).
+ * The F1 and L1 units are fixed to CRC-32 and only reset to 0xFFFFFFFF. */
+#if defined(STM32L0xx) || defined(STM32L4xx) || defined(STM32F3xx)
+#define CRC_PROGRAMMABLE 1
+#else
+#define CRC_PROGRAMMABLE 0
+#endif
+
+/* Default backend, override per target with -D CRC16_IMPL=... */
+#ifndef CRC16_IMPL
+#if CRC_PROGRAMMABLE
+#define CRC16_IMPL CRC16_HW
+#else
+#define CRC16_IMPL CRC16_NIBBLE
+#endif
+#endif
+
+#if (CRC16_IMPL == CRC16_HW) && !CRC_PROGRAMMABLE
+/* A fixed CRC-32 unit can't do CRC-16, use the software engine. */
+#undef CRC16_IMPL
+#define CRC16_IMPL CRC16_NIBBLE
+#endif
+
+/* Use the CRC unit for the CRC-32, 0 for the nibble table engine. */
+#ifndef CRC32_HW
+#define CRC32_HW 1
+#endif
+
+#define CRC32_INIT 0xFFFFFFFFu
+
+uint16_t crc16_update(uint16_t crc, const uint8_t *data, uint32_t length);
+uint32_t crc32_update(uint32_t crc, const uint32_t *data, uint32_t words);
+
+#if (CRC16_IMPL == CRC16_HW) || CRC32_HW
+void crc_init(void);
+#else
+#define crc_init()
+#endif
+
+#endif /* CRC_H_ */
@@ -0,0 +1,203 @@
+/**
+ * @file    delta.c
+ * @brief   In place patching of the application area.
+ */
+
+#include "delta.h"
+#include "flash.h"
+
+/* Sizes of the operation headers. */
+#define DELTA_COPY_SIZE    6u
+#define DELTA_LITERAL_SIZE 3u
+
+/* The new page being assembled (aligned for the flash writes). */
+static uint8_t delta_page[FLASH_PAGE_SIZE] __attribute__((aligned(8)));
+static uint32_t delta_page_address; /**< Flash address of delta_page. */
+static uint32_t delta_page_fill;    /**< Bytes already in delta_page. */
+static uint32_t delta_patch_left;   /**< Patch bytes still expected, the rest is padding. */
+static uint32_t delta_image_left;   /**< New image bytes still expected. */
+static uint32_t delta_old_size;     /**< Size of the installed image. */
+static uint8_t delta_op[DELTA_COPY_SIZE]; /**< Header of the current operation. */
+static uint8_t delta_op_fill;       /**< Bytes already in delta_op. */
+static uint16_t delta_literal_left; /**< Data bytes left of the current literal. */
+static delta_status delta_result;   /**< Sticky error. */
+
+/**
+ * @brief   Writes the assembled page to the flash, flash_update() leaves it
+ * alone if it is unchanged.
+ * @param   void
+ * @return  void
+ */
+static void delta_commit(void)
+{
+  if (FLASH_OK != flash_update(delta_page_address, (uint32_t *)&delta_page[0u], FLASH_PAGE_SIZE))
+  {
+    delta_result |= DELTA_ERROR_FLASH;
+  }
+
+  delta_page_address += FLASH_PAGE_SIZE;
+  delta_page_fill = 0u;
+}
+
+/**
+ * @brief   Appends new image data, committing every full page.
+ * @param   *data:  New image data (RAM or old flash content).
+ * @param   length: Size of the data, at most up to the end of the page.
+ * @return  void
+ */
+static void delta_put(const uint8_t *data, uint32_t length)
+{
+  if (delta_image_left < length)
+  {
+    delta_result |= DELTA_ERROR_PATCH;
+    return;
+  }
+  delta_image_left -= length;
+
+  for (uint32_t i = 0u; i < length; i++)
+  {
+    delta_page[delta_page_fill++] = data[i];
+  }
+  if (FLASH_PAGE_SIZE == delta_page_fill)
+  {
+    delta_commit();
+  }
+}
+
+/**
+ * @brief   Copies a range of the installed image to the new one.
+ * @param   offset: Start of the range in the old image.
+ * @param   length: Size of the range.
+ * @return  void
+ */
+static void delta_copy(uint32_t offset, uint32_t length)
+{
+  uint32_t source = FLASH_APP_START_ADDRESS + offset;
+
+  if ((delta_old_size < offset) || ((delta_old_size - offset) < length))
+  {
+    delta_result |= DELTA_ERROR_PATCH;
+  }
+
+  while ((0u != length) && (DELTA_OK == delta_result))
+  {
+    uint32_t chunk = FLASH_PAGE_SIZE - delta_page_fill;
+    if (length < chunk)
+    {
+      chunk = length;
+    }
+    /* The source page was overwritten already. */
+    if (delta_page_address > source)
+    {
+      delta_result |= DELTA_ERROR_PATCH;
+      break;
+    }
+    delta_put((const uint8_t *)FLASH_PTR(source), chunk);
+    source += chunk;
+    length -= chunk;
+  }
+}
+
+/**
+ * @brief   Starts rebuilding the application area.
+ * @param   patch_size: Size of the patch stream.
+ * @param   image_size: Size of the new image.
+ * @param   old_size:   Size of the installed image copies may read from.
+ * @return  void
+ */
+void delta_init(uint32_t patch_size, uint32_t image_size, uint32_t old_size)
+{
+  delta_page_address = FLASH_APP_START_ADDRESS;
+  delta_page_fill = 0u;
+  delta_patch_left = patch_size;
+  delta_image_left = image_size;
+  delta_old_size = old_size;
+  delta_op_fill = 0u;
+  delta_literal_left = 0u;
+  delta_result = DELTA_OK;
+}
+
+/**
+ * @brief   Executes the next chunk of the patch stream. Chunks can be split
+ * at any byte, bytes behind the patch are ignored.
+ * @param   *data:  Patch data.
+ * @param   length: Size of the data.
+ * @return  status: Report about the patching (now or earlier).
+ */
+delta_status delta_apply(uint8_t *data, uint16_t length)
+{
+  uint32_t i = 0u;
+
+  if (delta_patch_left < length)
+  {
+    length = (uint16_t)delta_patch_left;
+  }
+  delta_patch_left -= length;
+
+  while ((i < length) && (DELTA_OK == delta_result))
+  {
+    /* Data of a literal, up to the end of the chunk or the page. */
+    if (0u != delta_literal_left)
+    {
+      uint32_t chunk = FLASH_PAGE_SIZE - delta_page_fill;
+      if ((length - i) < chunk)
+      {
+        chunk = length - i;
+      }
+      if (delta_literal_left < chunk)
+      {
+        chunk = delta_literal_left;
+      }
+      delta_put(&data[i], chunk);
+      delta_literal_left -= (uint16_t)chunk;
+      i += chunk;
+      continue;
+    }
+
+    /* Collect the header of the next operation. */
+    delta_op[delta_op_fill++] = data[i++];
+    if ((DELTA_OP_COPY == delta_op[0u]) && (DELTA_COPY_SIZE == delta_op_fill))
+    {
+      delta_copy((uint32_t)delta_op[1u] | ((uint32_t)delta_op[2u] << 8u) | ((uint32_t)delta_op[3u] << 16u),
+                 (uint32_t)delta_op[4u] | ((uint32_t)delta_op[5u] << 8u));
+      delta_op_fill = 0u;
+    }
+    else if ((DELTA_OP_LITERAL == delta_op[0u]) && (DELTA_LITERAL_SIZE == delta_op_fill))
+    {
+      delta_literal_left = (uint16_t)delta_op[1u] | ((uint16_t)delta_op[2u] << 8u);
+      delta_op_fill = 0u;
+    }
+    else if ((DELTA_OP_COPY != delta_op[0u]) && (DELTA_OP_LITERAL != delta_op[0u]))
+    {
+      delta_result |= DELTA_ERROR_PATCH;
+    }
+  }
+
+  return delta_result;
+}
+
+/**
+ * @brief   Checks that the patch was complete and writes the last page, padded
+ * with erased flash.
+ * @param   void
+ * @return  status: Report about the patching.
+ */
+delta_status delta_finish(void)
+{
+  if ((0u != delta_patch_left) || (0u != delta_image_left) ||
+      (0u != delta_op_fill) || (0u != delta_literal_left))
+  {
+    delta_result |= DELTA_ERROR_PATCH;
+  }
+
+  if ((DELTA_OK == delta_result) && (0u != delta_page_fill))
+  {
+    while (FLASH_PAGE_SIZE != delta_page_fill)
+    {
+      delta_page[delta_page_fill++] = (uint8_t)FLASH_ERASED_WORD;
+    }
+    delta_commit();
+  }
+
+  return delta_result;
+}
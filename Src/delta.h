@@ -0,0 +1,35 @@
+/**
+ * @file    delta.h
+ * @brief   Rebuilds the application in place from the installed image and a
+ *          patch stream.
+ *
+ *          Patch stream, little endian:
+ *            0x01, offset (3 bytes), length (2 bytes): copy from the old image.
+ *            0x02, length (2 bytes), data:             new bytes.
+ *          The new image is assembled page by page in RAM. A page is only
+ *          erased and written if it differs from the flash, so unchanged
+ *          pages cost neither transfer nor wear. Pages before the one being
+ *          built may already hold new data, copies must not read from them.
+ */
+
+#ifndef DELTA_H_
+#define DELTA_H_
+
+#include <stdint.h>
+
+/* Patch operations. */
+#define DELTA_OP_COPY    ((uint8_t)0x01u)
+#define DELTA_OP_LITERAL ((uint8_t)0x02u)
+
+/* Status report for the functions. */
+#define DELTA_OK 0x00u          /**< The action was successful. */
+#define DELTA_ERROR_PATCH 0x01u /**< Broken patch or wrong sizes. */
+#define DELTA_ERROR_FLASH 0x02u /**< Erasing or writing failed. */
+
+typedef uint8_t delta_status;
+
+void delta_init(uint32_t patch_size, uint32_t image_size, uint32_t old_size);
+delta_status delta_apply(uint8_t *data, uint16_t length);
+delta_status delta_finish(void);
+
+#endif /* DELTA_H_ */
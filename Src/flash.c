@@ -8,7 +8,10 @@
  */
 
 #include "flash.h"
+#include "crc.h"
 #include "main.h"
+#include <stddef.h>
+#include <string.h>
 
 #ifndef FLASH_TYPEPROGRAM_HALFWORD
 #define FLASH_TYPEPROGRAM_HALFWORD 0 // should fail
@@ -44,15 +47,233 @@ uint32_t get_flash_end(void) {
 /* Function pointer for jumping to user application. */
 typedef void (*fnc_ptr)(void);
 
+/* Application pages erased (or found blank) since the last
+ * flash_erase_reset(). */
+static uint32_t flash_erase_map[FLASH_ERASE_MAP_PAGES / 32u];
+/* Pages left alone so far, all data written to them was already there. */
+static uint32_t flash_keep_map[FLASH_ERASE_MAP_PAGES / 32u];
+static uint32_t flash_blank_pages; /**< Erases skipped, the page was blank. */
+/* Content of a page in front of the written range, kept over the erase. */
+static uint32_t flash_page_buffer[FLASH_PAGE_SIZE / 4u] __attribute__((aligned(8)));
+#if FLASH_CACHE
+/* Page collected by flash_cache_write(), not written yet. */
+static uint32_t flash_cache[FLASH_PAGE_SIZE / 4u] __attribute__((aligned(8)));
+static uint32_t flash_cache_address; /**< Page in flash_cache, 0 if none. */
+#endif
+/* The flash stays unlocked from flash_session_begin() to flash_session_end()
+ * or flash_session_abort(), instead of once per erase or write. */
+static uint8_t flash_session_unlocked;
+
+static uint8_t flash_page_blank(uint32_t address);
+static void flash_open(void);
+static void flash_close(void);
+static void flash_session_hold(void);
+
+/* Access to the flash controller, through the HAL or (FLASH_USE_LL) directly
+ * through its registers, without the HAL's timeouts and bookkeeping.
+ * flash_program() writes one word, a double word on the L4. */
+
+#if FLASH_USE_LL
+#define FLASH_LL_KEY1 0x45670123u
+#define FLASH_LL_KEY2 0xCDEF89ABu
+#if defined(STM32L0xx)
+#define FLASH_LL_PEKEY1 0x89ABCDEFu
+#define FLASH_LL_PEKEY2 0x02030405u
+#define FLASH_LL_PRGKEY1 0x8C9DAEBFu
+#define FLASH_LL_PRGKEY2 0x13141516u
+#define FLASH_LL_ERRORS (FLASH_SR_WRPERR | FLASH_SR_PGAERR | FLASH_SR_SIZERR | FLASH_SR_OPTVERR | \
+                         FLASH_SR_RDERR | FLASH_SR_FWWERR | FLASH_SR_NOTZEROERR)
+#elif defined(STM32L4xx)
+#define FLASH_LL_ERRORS (FLASH_SR_OPERR | FLASH_SR_PROGERR | FLASH_SR_WRPERR | FLASH_SR_PGAERR | \
+                         FLASH_SR_SIZERR | FLASH_SR_PGSERR | FLASH_SR_MISERR | FLASH_SR_FASTERR | \
+                         FLASH_SR_RDERR | FLASH_SR_OPTVERR)
+#elif defined(FLASH_SR_WRPRTERR) // F1
+#define FLASH_LL_ERRORS (FLASH_SR_PGERR | FLASH_SR_WRPRTERR)
+#else // F3
+#define FLASH_LL_ERRORS (FLASH_SR_PGERR | FLASH_SR_WRPERR)
+#endif
+
 /**
- * @brief   This function erases the memory.
- * @param   address: First address to be erased (the last is the end of the
- * flash).
- * @return  status: Report about the success of the erasing.
+ * @brief   Waits for the end of the operation and clears its flags.
+ * @param   void
+ * @return  status: FLASH_ERROR_WRITE if the controller reported an error.
  */
-flash_status flash_erase(uint32_t address)
+static flash_status flash_ll_wait(void)
+{
+  uint32_t errors;
+
+  while (0u != (FLASH->SR & FLASH_SR_BSY))
+  {
+  }
+  errors = FLASH->SR & FLASH_LL_ERRORS;
+  FLASH->SR = errors | FLASH_SR_EOP;
+
+  return (0u != errors) ? FLASH_ERROR_WRITE : FLASH_OK;
+}
+
+static void flash_unlock(void)
+{
+#if defined(STM32L0xx)
+  if (0u != (FLASH->PECR & FLASH_PECR_PELOCK))
+  {
+    FLASH->PEKEYR = FLASH_LL_PEKEY1;
+    FLASH->PEKEYR = FLASH_LL_PEKEY2;
+  }
+  if (0u != (FLASH->PECR & FLASH_PECR_PRGLOCK))
+  {
+    FLASH->PRGKEYR = FLASH_LL_PRGKEY1;
+    FLASH->PRGKEYR = FLASH_LL_PRGKEY2;
+  }
+#else
+  if (0u != (FLASH->CR & FLASH_CR_LOCK))
+  {
+    FLASH->KEYR = FLASH_LL_KEY1;
+    FLASH->KEYR = FLASH_LL_KEY2;
+  }
+#endif
+  /* Errors left by an earlier operation block the next one. */
+  FLASH->SR = FLASH_LL_ERRORS;
+}
+
+static void flash_lock(void)
+{
+#if defined(STM32L0xx)
+  FLASH->PECR |= FLASH_PECR_PRGLOCK;
+  FLASH->PECR |= FLASH_PECR_PELOCK;
+#else
+  FLASH->CR |= FLASH_CR_LOCK;
+#endif
+}
+
+static flash_status flash_erase_one(uint32_t address)
+{
+  flash_status status;
+
+#if defined(STM32L0xx)
+  FLASH->PECR |= FLASH_PECR_ERASE | FLASH_PECR_PROG;
+  *(volatile uint32_t *)address = 0u;
+  status = flash_ll_wait();
+  FLASH->PECR &= ~(FLASH_PECR_ERASE | FLASH_PECR_PROG);
+#elif defined(STM32L4xx)
+  uint32_t cr = FLASH->CR & ~(FLASH_CR_PNB | FLASH_CR_PER);
+#ifdef FLASH_CR_BKER
+  cr &= ~FLASH_CR_BKER;
+#endif
+  FLASH->CR = cr | (((address - FLASH_BASE) / FLASH_PAGE_SIZE) << FLASH_CR_PNB_Pos) | FLASH_CR_PER;
+  FLASH->CR |= FLASH_CR_STRT;
+  status = flash_ll_wait();
+  FLASH->CR &= ~(FLASH_CR_PNB | FLASH_CR_PER);
+  /* The caches may still hold the old content. */
+  if (0u != (FLASH->ACR & FLASH_ACR_DCEN))
+  {
+    FLASH->ACR &= ~FLASH_ACR_DCEN;
+    FLASH->ACR |= FLASH_ACR_DCRST;
+    FLASH->ACR &= ~FLASH_ACR_DCRST;
+    FLASH->ACR |= FLASH_ACR_DCEN;
+  }
+  if (0u != (FLASH->ACR & FLASH_ACR_ICEN))
+  {
+    FLASH->ACR &= ~FLASH_ACR_ICEN;
+    FLASH->ACR |= FLASH_ACR_ICRST;
+    FLASH->ACR &= ~FLASH_ACR_ICRST;
+    FLASH->ACR |= FLASH_ACR_ICEN;
+  }
+#else
+  FLASH->CR |= FLASH_CR_PER;
+  FLASH->AR = address;
+  FLASH->CR |= FLASH_CR_STRT;
+  status = flash_ll_wait();
+  FLASH->CR &= ~FLASH_CR_PER;
+#endif
+
+  return (FLASH_OK == status) ? FLASH_OK : FLASH_ERROR;
+}
+
+static flash_status flash_program(uint32_t address, const uint32_t *data)
+{
+  flash_status status;
+
+#if defined(STM32L0xx)
+  *(volatile uint32_t *)address = data[0u];
+  status = flash_ll_wait();
+#elif defined(STM32L4xx)
+  FLASH->CR |= FLASH_CR_PG;
+  *(volatile uint32_t *)address = data[0u];
+  __ISB();
+  *(volatile uint32_t *)(address + 4u) = data[1u];
+  status = flash_ll_wait();
+  FLASH->CR &= ~FLASH_CR_PG;
+#else
+  /* The F1/F3 controller programs half words. */
+  FLASH->CR |= FLASH_CR_PG;
+  *(volatile uint16_t *)address = (uint16_t)data[0u];
+  status = flash_ll_wait();
+  *(volatile uint16_t *)(address + 2u) = (uint16_t)(data[0u] >> 16u);
+  status |= flash_ll_wait();
+  FLASH->CR &= ~FLASH_CR_PG;
+#endif
+
+  return status;
+}
+
+static flash_status flash_program_halfword(uint32_t address, uint16_t data)
+{
+#if defined(STM32L0xx) || defined(STM32L4xx)
+  (void)address;
+  (void)data;
+  return FLASH_ERROR_WRITE;
+#else
+  flash_status status;
+
+  FLASH->CR |= FLASH_CR_PG;
+  *(volatile uint16_t *)address = data;
+  status = flash_ll_wait();
+  FLASH->CR &= ~FLASH_CR_PG;
+
+  return status;
+#endif
+}
+
+#if FLASH_HALF_PAGES
+/* Runs from RAM, the flash can't be read while the words are loaded. */
+__attribute__((section(".RamFunc"), noinline))
+static flash_status flash_program_half_page(uint32_t address, const uint32_t *data)
+{
+  uint32_t primask;
+  uint32_t errors;
+
+  FLASH->PECR |= FLASH_PECR_PROG | FLASH_PECR_FPRG;
+  primask = __get_PRIMASK();
+  __disable_irq();
+  for (uint32_t i = 0u; i < (FLASH_HALF_PAGE_SIZE / 4u); i++)
+  {
+    ((volatile uint32_t *)address)[i] = data[i];
+  }
+  __set_PRIMASK(primask);
+  while (0u != (FLASH->SR & FLASH_SR_BSY))
+  {
+  }
+  errors = FLASH->SR & FLASH_LL_ERRORS;
+  FLASH->SR = errors | FLASH_SR_EOP;
+  FLASH->PECR &= ~(FLASH_PECR_PROG | FLASH_PECR_FPRG);
+
+  return (0u != errors) ? FLASH_ERROR_WRITE : FLASH_OK;
+}
+#endif
+
+#else // !FLASH_USE_LL
+static void flash_unlock(void)
+{
+  HAL_FLASH_Unlock();
+}
+
+static void flash_lock(void)
+{
+  HAL_FLASH_Lock();
+}
+
+static flash_status flash_erase_one(uint32_t address)
 {
-  flash_status status = FLASH_ERROR;
   FLASH_EraseInitTypeDef erase_init;
   uint32_t error = 0u;
 
@@ -65,52 +286,624 @@ flash_status flash_erase(uint32_t address)
 #ifdef FLASH_BANK_1
   erase_init.Banks = FLASH_BANK_1;
 #endif
-  /* Calculate the number of pages from "address" and the end of flash. */
-  erase_init.NbPages = (FLASH_APP_END_ADDRESS - address + 1) / FLASH_PAGE_SIZE;
-  /* Do the actual erasing. */
-  HAL_FLASH_Unlock();
-  if (HAL_OK == HAL_FLASHEx_Erase(&erase_init, &error))
+  erase_init.NbPages = 1;
+
+  return (HAL_OK == HAL_FLASHEx_Erase(&erase_init, &error)) ? FLASH_OK : FLASH_ERROR;
+}
+
+static flash_status flash_program(uint32_t address, const uint32_t *data)
+{
+#if defined(STM32L4xx)
+  uint64_t value = (uint64_t)data[0u] | ((uint64_t)data[1u] << 32u);
+  return (HAL_OK == HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, address, value)) ? FLASH_OK : FLASH_ERROR_WRITE;
+#else
+  return (HAL_OK == HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address, data[0u])) ? FLASH_OK : FLASH_ERROR_WRITE;
+#endif
+}
+
+static flash_status flash_program_halfword(uint32_t address, uint16_t data)
+{
+  return (HAL_OK == HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, address, data)) ? FLASH_OK : FLASH_ERROR_WRITE;
+}
+
+#if FLASH_HALF_PAGES
+/* HAL_FLASHEx_HalfPageProgram() runs from RAM (.RamFunc). */
+static flash_status flash_program_half_page(uint32_t address, const uint32_t *data)
+{
+  return (HAL_OK == HAL_FLASHEx_HalfPageProgram(address, (uint32_t *)data)) ? FLASH_OK : FLASH_ERROR_WRITE;
+}
+#endif
+#endif // FLASH_USE_LL
+
+#if FLASH_SESSION
+/* Session record: a header {id, size ^ MAGIC} followed by an append-only log
+ * of committed offsets {offset, ~offset}. Neither can look erased. */
+#define FLASH_SESSION_MAGIC 0xB0000000u
+#define FLASH_SESSION_MASK 0xF0000000u
+#define FLASH_SESSION_ENTRIES (FLASH_PAGE_SIZE / 8u)
+
+/* End of the bootloader image (from the linker script). */
+#ifndef BL_FLASH_IMAGE_END
+extern uint32_t _sidata, _sdata, _edata;
+#define BL_FLASH_IMAGE_END ((uint32_t)&_sidata + ((uint32_t)&_edata - (uint32_t)&_sdata))
+#endif
+
+static uint32_t flash_session_logged; /**< Last offset in the log. */
+
+static int8_t flash_session_available(void);
+static uint32_t flash_session_step(void);
+static uint32_t *flash_session_entry(uint32_t index);
+static int8_t flash_session_active(void);
+static int8_t flash_image_check(void);
+#endif
+
+/**
+ * @brief   Unlocks the flash for one erase or write, unless a session holds it
+ * unlocked already.
+ * @param   void
+ * @return  void
+ */
+static void flash_open(void)
+{
+  if (!flash_session_unlocked)
   {
-    status = FLASH_OK;
+    flash_unlock();
+  }
+}
+
+/**
+ * @brief   Locks the flash again after flash_open().
+ * @param   void
+ * @return  void
+ */
+static void flash_close(void)
+{
+  if (!flash_session_unlocked)
+  {
+    flash_lock();
+  }
+}
+
+/**
+ * @brief   Unlocks the flash for the rest of the session.
+ * @param   void
+ * @return  void
+ */
+static void flash_session_hold(void)
+{
+  if (!flash_session_unlocked)
+  {
+    flash_unlock();
+    flash_session_unlocked = 1u;
+  }
+}
+
+/**
+ * @brief   Stops the session without completing the image and locks the
+ * flash. A cached page is dropped, an unfinished record stays and the image
+ * can still be resumed.
+ * @param   void
+ * @return  void
+ */
+void flash_session_abort(void)
+{
+#if FLASH_CACHE
+  flash_cache_address = 0u;
+#endif
+  if (flash_session_unlocked)
+  {
+    flash_session_unlocked = 0u;
+    flash_lock();
+  }
+}
+
+/**
+ * @brief   This function erases the memory.
+ * @param   address: First address to be erased (the last is the end of the
+ * flash).
+ * @return  status: Report about the success of the erasing.
+ */
+flash_status flash_erase(uint32_t address)
+{
+  flash_status status = FLASH_OK;
+
+  /* Page by page, blank pages are skipped. */
+  for (; (address < FLASH_APP_END_ADDRESS) && (FLASH_OK == status); address += FLASH_PAGE_SIZE)
+  {
+    if (!flash_page_blank(address))
+    {
+      status |= flash_erase_page(address);
+    }
   }
-  HAL_FLASH_Lock();
 
   return status;
 }
 
+/**
+ * @brief   Checks if a page is erased.
+ * @param   address: Start of the page.
+ * @return  1 if every word of the page is erased, 0 otherwise.
+ */
+static uint8_t flash_page_blank(uint32_t address)
+{
+  for (uint32_t offset = 0u; offset < FLASH_PAGE_SIZE; offset += 4u)
+  {
+    if (FLASH_ERASED_WORD != *(volatile uint32_t *)FLASH_PTR(address + offset))
+    {
+      return 0u;
+    }
+  }
+  return 1u;
+}
+
 /**
  * @brief   This function erases the current flash page.
  * @param   address: address to be erased.
  * @return  status: Report about the success of the erasing.
  */
 flash_status flash_erase_page(uint32_t address)
+{
+  flash_status status;
+
+  /* Do the actual erasing. */
+  flash_open();
+  status = flash_erase_one(address);
+  flash_close();
+
+  return status;
+}
+
+/**
+ * @brief   Forgets which pages were erased or kept, the next write to any
+ * page of the application area will check it again.
+ * @param   void
+ * @return  void
+ */
+void flash_erase_reset(void)
+{
+  for (uint32_t i = 0u; i < (FLASH_ERASE_MAP_PAGES / 32u); i++)
+  {
+    flash_erase_map[i] = 0u;
+    flash_keep_map[i] = 0u;
+  }
+  flash_blank_pages = 0u;
+}
+
+/**
+ * @brief   Writes a range of the application area. A page is only erased by
+ * the first write since the last flash_erase_reset() which changes it, and
+ * not at all if it is blank. Data already in the flash is not written again.
+ * Content of the page in front of the range survives the erase.
+ * @param   address: First address to be written to, doubleword aligned.
+ * @param   *data:   Array of the data that we want to write.
+ * @param   length:  Size of the range in bytes, multiple of 8.
+ * @return  status: Report about the success of the writing.
+ */
+flash_status flash_update(uint32_t address, uint32_t *data, uint32_t length)
 {
   flash_status status = FLASH_OK;
-  FLASH_EraseInitTypeDef erase_init;
-  uint32_t error = 0u;
 
-  erase_init.TypeErase = FLASH_TYPEERASE_PAGES;
-#if defined(STM32L4xx)
-  erase_init.Page = (address - FLASH_BASE) / FLASH_PAGE_SIZE;
+  if ((FLASH_APP_START_ADDRESS > address) || (0u == length) ||
+      (FLASH_APP_END_ADDRESS < (address + length - 1u)))
+  {
+    return FLASH_ERROR_SIZE;
+  }
+
+  while ((0u != length) && (FLASH_OK == status))
+  {
+    uint32_t page = (address - FLASH_APP_START_ADDRESS) / FLASH_PAGE_SIZE;
+    uint32_t page_address = FLASH_APP_START_ADDRESS + (page * FLASH_PAGE_SIZE);
+    uint32_t part = page_address + FLASH_PAGE_SIZE - address;
+    uint32_t mask = 1u << (page % 32u);
+    if (length < part)
+    {
+      part = length;
+    }
+
+    if (FLASH_ERASE_MAP_PAGES <= page)
+    {
+      status |= FLASH_ERROR_SIZE;
+    }
+    else if (0u != (flash_erase_map[page / 32u] & mask))
+    {
+      status |= flash_write(address, data, part / 4u);
+    }
+    /* Nothing changes (yet), leave the page alone. */
+    else if (0 == memcmp((const void *)FLASH_PTR(address), data, part))
+    {
+      flash_keep_map[page / 32u] |= mask;
+    }
+    else
+    {
+      if ((0u == (flash_keep_map[page / 32u] & mask)) && flash_page_blank(page_address))
+      {
+        flash_blank_pages++;
+      }
+      else
+      {
+        /* The data in front is either old content the host didn't send or
+           was identical, it has to be restored. */
+        uint32_t keep = address - page_address;
+        memcpy(&flash_page_buffer[0u], (const void *)FLASH_PTR(page_address), keep);
+        status |= flash_erase_page(page_address);
+        if ((FLASH_OK == status) && (0u != keep))
+        {
+          status |= flash_write(page_address, &flash_page_buffer[0u], keep / 4u);
+        }
+      }
+      flash_erase_map[page / 32u] |= mask;
+      flash_keep_map[page / 32u] &= ~mask;
+      if (FLASH_OK == status)
+      {
+        status |= flash_write(address, data, part / 4u);
+      }
+    }
+
+    address += part;
+    data += part / 4u;
+    length -= part;
+  }
+
+  return status;
+}
+
+/**
+ * @brief   Reports the work flash_update() saved since the last
+ * flash_erase_reset().
+ * @param   *kept:  Pages neither erased nor written, content was identical.
+ * @param   *blank: Pages written without an erase.
+ * @return  void
+ */
+void flash_update_stats(uint32_t *kept, uint32_t *blank)
+{
+  *kept = 0u;
+  for (uint32_t page = 0u; page < FLASH_ERASE_MAP_PAGES; page++)
+  {
+    if (flash_keep_map[page / 32u] & (1u << (page % 32u)))
+    {
+      (*kept)++;
+    }
+  }
+  *blank = flash_blank_pages;
+}
+
+#if FLASH_CACHE
+/**
+ * @brief   Writes a range through the page cache. The page is read into RAM
+ * when the range enters it, so partial and out of order writes keep the rest
+ * of the page, and written back with one erase when the range leaves it.
+ * @param   address: First address to be written to.
+ * @param   *data:   Data, no alignment needed.
+ * @param   length:  Size of the range in bytes.
+ * @return  status: Report about the writing of a page left behind.
+ */
+flash_status flash_cache_write(uint32_t address, const uint8_t *data, uint32_t length)
+{
+  flash_status status = FLASH_OK;
+
+  if ((FLASH_APP_START_ADDRESS > address) || (0u == length) ||
+      (FLASH_APP_END_ADDRESS < (address + length - 1u)))
+  {
+    return FLASH_ERROR_SIZE;
+  }
+
+  while ((0u != length) && (FLASH_OK == status))
+  {
+    uint32_t page_address = address & ~(FLASH_PAGE_SIZE - 1u);
+    uint32_t offset = address - page_address;
+    uint32_t part = FLASH_PAGE_SIZE - offset;
+    if (length < part)
+    {
+      part = length;
+    }
+
+    if (page_address != flash_cache_address)
+    {
+      status |= flash_cache_flush();
+      memcpy(&flash_cache[0u], (const void *)FLASH_PTR(page_address), FLASH_PAGE_SIZE);
+      flash_cache_address = page_address;
+    }
+    memcpy((uint8_t *)&flash_cache[0u] + offset, data, part);
+
+    address += part;
+    data += part;
+    length -= part;
+  }
+
+  return status;
+}
+
+/**
+ * @brief   Writes the cached page back, flash_update() leaves it alone if it
+ * is unchanged.
+ * @param   void
+ * @return  status: Report about the success of the writing.
+ */
+flash_status flash_cache_flush(void)
+{
+  flash_status status = FLASH_OK;
+
+  if (0u != flash_cache_address)
+  {
+    /* The page may have been written before, let flash_update() check it
+       again instead of writing onto it. */
+    uint32_t page = (flash_cache_address - FLASH_APP_START_ADDRESS) / FLASH_PAGE_SIZE;
+    if (FLASH_ERASE_MAP_PAGES > page)
+    {
+      flash_erase_map[page / 32u] &= ~(1u << (page % 32u));
+    }
+    status |= flash_update(flash_cache_address, &flash_cache[0u], FLASH_PAGE_SIZE);
+    flash_cache_address = 0u;
+  }
+
+  return status;
+}
+#endif /* FLASH_CACHE */
+
+/**
+ * @brief   Erases the stale pages behind the image, up to the end of the
+ * flash. Blank pages are skipped.
+ * @param   address: End of the image, the page holding it is kept.
+ * @return  status: Report about the success of the erasing.
+ */
+flash_status flash_erase_tail(uint32_t address)
+{
+  flash_status status = FLASH_OK;
+
+  /* Start at the next page boundary. */
+  address = (address + FLASH_PAGE_SIZE - 1u) & ~(FLASH_PAGE_SIZE - 1u);
+
+  for (; (address < FLASH_APP_END_ADDRESS) && (FLASH_OK == status); address += FLASH_PAGE_SIZE)
+  {
+    if (!flash_page_blank(address))
+    {
+      status |= flash_erase_page(address);
+    }
+  }
+
+  return status;
+}
+
+#if FLASH_SESSION
+/**
+ * @brief   Checks that the session page is free, the bootloader image may
+ * reach into it on small parts.
+ * @param   void
+ * @return  1 if the session record can be used, 0 otherwise.
+ */
+static int8_t flash_session_available(void)
+{
+  return ((BL_FLASH_START <= FLASH_SESSION_ADDRESS) && (BL_FLASH_IMAGE_END <= FLASH_SESSION_ADDRESS)) ? 1 : 0;
+}
+
+/**
+ * @brief   Distance of two log entries, the log spreads over the whole
+ * application area in whole pages.
+ * @param   void
+ * @return  Step in bytes.
+ */
+static uint32_t flash_session_step(void)
+{
+  uint32_t step = (FLASH_APP_END_ADDRESS - FLASH_APP_START_ADDRESS + 1u) / (FLASH_SESSION_ENTRIES - 1u);
+  return (step + FLASH_PAGE_SIZE - 1u) & ~(FLASH_PAGE_SIZE - 1u);
+}
+
+/**
+ * @brief   Address of a record entry (two words).
+ * @param   index: Entry number, 0 is the header.
+ * @return  Pointer to the entry in the flash.
+ */
+static uint32_t *flash_session_entry(uint32_t index)
+{
+  return (uint32_t *)FLASH_PTR(FLASH_SESSION_ADDRESS + (index * 8u));
+}
+
+/**
+ * @brief   Checks for an unfinished update.
+ * @param   void
+ * @return  1 if a session record exists, 0 otherwise.
+ */
+static int8_t flash_session_active(void)
+{
+  return (flash_session_available() &&
+          (FLASH_SESSION_MAGIC == (flash_session_entry(0u)[1u] & FLASH_SESSION_MASK))) ? 1 : 0;
+}
+
+/**
+ * @brief   Checks the image against its descriptor. The CRC is only
+ * calculated until it matched once.
+ * @param   void
+ * @return  0 if the image is intact or has no descriptor, -1 otherwise.
+ */
+static int8_t flash_image_check(void)
+{
+  const flash_image *image = (const flash_image *)FLASH_PTR(FLASH_SESSION_ADDRESS);
+  uint32_t mark[2u] = {FLASH_IMAGE_VERIFIED, ~FLASH_IMAGE_VERIFIED};
+
+  /* Written by an older bootloader, only the vectors can be checked. */
+  if (!flash_session_available() || (FLASH_IMAGE_MAGIC != image->magic))
+  {
+    return 0;
+  }
+  if ((mark[0u] == image->verified) && (mark[1u] == image->verified_check))
+  {
+    return 0;
+  }
+  if (((FLASH_APP_END_ADDRESS - FLASH_APP_START_ADDRESS + 1u) < image->length) ||
+      (image->crc != flash_image_crc(image->length)))
+  {
+    return -1;
+  }
+  (void)flash_write(FLASH_SESSION_ADDRESS + offsetof(flash_image, verified), &mark[0u], 2u);
+  return 0;
+}
+#endif /* FLASH_SESSION */
+
+/**
+ * @brief   Starts a new update session, the application stays invalid until
+ * flash_session_end(). The flash stays unlocked until then.
+ * @param   size: Size of the image, 0 if unknown.
+ * @param   id:   Identifier of the image given by the host.
+ * @return  status: Report about the success of the writing.
+ */
+flash_status flash_session_begin(uint32_t size, uint32_t id)
+{
+  flash_status status = FLASH_OK;
+
+  /* Every page is checked again before it is erased. */
+  flash_erase_reset();
+#if FLASH_CACHE
+  flash_cache_address = 0u;
+#endif
+  flash_session_hold();
+#if FLASH_SESSION
+  uint32_t header[2u] = {id, size ^ FLASH_SESSION_MAGIC};
+
+  if (!flash_session_available())
+  {
+    return FLASH_OK;
+  }
+  flash_session_logged = 0u;
+
+  status |= flash_erase_page(FLASH_SESSION_ADDRESS);
+  if (FLASH_OK == status)
+  {
+    status |= flash_write(FLASH_SESSION_ADDRESS, &header[0u], 2u);
+  }
 #else
-  erase_init.PageAddress = address;
+  (void)size;
+  (void)id;
 #endif
-#ifdef FLASH_BANK_1
-  erase_init.Banks = FLASH_BANK_1;
+  return status;
+}
+
+/**
+ * @brief   Looks for an unfinished session of the same image.
+ *          On a match the session goes on (unlocked), the image is valid up
+ * to the returned offset.
+ * @param   size: Size of the image.
+ * @param   id:   Identifier of the image given by the host.
+ * @return  Offset to continue from, 0 if the image has to be sent again.
+ */
+uint32_t flash_session_resume(uint32_t size, uint32_t id)
+{
+  uint32_t offset = 0u;
+#if FLASH_SESSION
+  uint32_t *entry = flash_session_entry(0u);
+
+  if ((0u == size) || !flash_session_active() ||
+      (id != entry[0u]) || (size != (entry[1u] ^ FLASH_SESSION_MAGIC)))
+  {
+    return 0u;
+  }
+  for (uint32_t i = 1u; i < FLASH_SESSION_ENTRIES; i++)
+  {
+    entry = flash_session_entry(i);
+    if (entry[1u] == ~entry[0u])
+    {
+      offset = entry[0u];
+    }
+  }
+  if (size < offset)
+  {
+    offset = 0u;
+  }
+  flash_session_logged = offset;
+  if (0u != offset)
+  {
+    flash_session_hold();
+  }
+#else
+  (void)size;
+  (void)id;
 #endif
-  erase_init.NbPages = 1;
+  return offset;
+}
 
-  /* Do the actual erasing. */
-  HAL_FLASH_Unlock();
-  if (HAL_OK != HAL_FLASHEx_Erase(&erase_init, &error))
+/**
+ * @brief   Records that the image is written up to an offset. Only logged once
+ * per step, rounded down to whole pages.
+ * @param   offset: Size of the image data in the flash.
+ * @return  status: Report about the success of the writing.
+ */
+flash_status flash_session_commit(uint32_t offset)
+{
+  flash_status status = FLASH_OK;
+#if FLASH_SESSION
+  if (!flash_session_active())
   {
-    status = FLASH_ERROR;
+    return FLASH_OK;
   }
-  HAL_FLASH_Lock();
+  offset -= offset % flash_session_step();
+  if (offset <= flash_session_logged)
+  {
+    return FLASH_OK;
+  }
+  /* Append behind the last used entry. */
+  for (uint32_t i = 1u; i < FLASH_SESSION_ENTRIES; i++)
+  {
+    uint32_t *entry = flash_session_entry(i);
+    if ((FLASH_ERASED_WORD == entry[0u]) && (FLASH_ERASED_WORD == entry[1u]))
+    {
+      uint32_t record[2u] = {offset, ~offset};
+      status |= flash_write(FLASH_SESSION_ADDRESS + (i * 8u), &record[0u], 2u);
+      flash_session_logged = offset;
+      break;
+    }
+  }
+#else
+  (void)offset;
+#endif
+  return status;
+}
 
+/**
+ * @brief   Ends the session, the application is complete. The session record
+ * is replaced by the descriptor of the image and the flash is locked.
+ * @param   length:  Size of the image, rounded up to whole words.
+ * @param   crc:     flash_image_crc() of the image.
+ * @param   version: Version of the image given by the host, 0 if unknown.
+ * @return  status: Report about the success of the writing.
+ */
+flash_status flash_session_end(uint32_t length, uint32_t crc, uint32_t version)
+{
+  flash_status status = FLASH_OK;
+#if FLASH_CACHE
+  /* Normally flushed already, the caller calculated the CRC from the flash. */
+  status |= flash_cache_flush();
+#endif
+#if FLASH_SESSION
+  /* A failed write leaves the session record, the image is not started. */
+  if ((FLASH_OK == status) && flash_session_active())
+  {
+    flash_image image = {FLASH_IMAGE_MAGIC, (length + 3u) & ~3u, crc, version,
+                         FLASH_ERASED_WORD, FLASH_ERASED_WORD};
+
+    status |= flash_erase_page(FLASH_SESSION_ADDRESS);
+    if (FLASH_OK == status)
+    {
+      status |= flash_write(FLASH_SESSION_ADDRESS, &image.magic, 4u);
+    }
+  }
+#else
+  (void)length;
+  (void)crc;
+  (void)version;
+#endif
+  flash_session_abort();
   return status;
 }
 
+/**
+ * @brief   Calculates the CRC-32 of the start of the application area.
+ * @param   length: Size of the image, rounded up to whole words.
+ * @return  The CRC.
+ */
+uint32_t flash_image_crc(uint32_t length)
+{
+  return crc32_update(CRC32_INIT, (const uint32_t *)FLASH_PTR(FLASH_APP_START_ADDRESS), (length + 3u) / 4u);
+}
+
 /**
  * @brief   This function flashes the memory.
  * @param   address: First address to be written to.
@@ -124,7 +917,7 @@ flash_status flash_write(uint32_t address, uint32_t *data, uint32_t length) {
 
   length = (length + 1) >> 1; // roundup and convert to double words
 
-  HAL_FLASH_Unlock();
+  flash_open();
 
   /* Loop through the array. */
   for (uint32_t i = 0u; (i < length) && (FLASH_OK == status); i++) {
@@ -134,14 +927,11 @@ flash_status flash_write(uint32_t address, uint32_t *data, uint32_t length) {
       status |= FLASH_ERROR_SIZE;
     } else {
       /* The actual flashing. If there is an error, then report it. */
-      if (HAL_OK != HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, address,
-                                      *(uint64_t *)data)) {
-        status |= FLASH_ERROR_WRITE;
-      }
+      status |= flash_program(address, data);
       /* Read back the content of the memory. If it is wrong, then report an
        * error. */
-      if (((*data++) != (*(volatile uint32_t *)address)) ||
-          ((*data++) != (*(volatile uint32_t *)(address + sizeof(uint32_t))))) {
+      if (((*data++) != (*(volatile uint32_t *)FLASH_PTR(address))) ||
+          ((*data++) != (*(volatile uint32_t *)FLASH_PTR(address + sizeof(uint32_t))))) {
         status |= FLASH_ERROR_READBACK;
       }
 
@@ -150,16 +940,42 @@ flash_status flash_write(uint32_t address, uint32_t *data, uint32_t length) {
     }
   }
 
-  HAL_FLASH_Lock();
+  flash_close();
 
   return status;
 }
 
 #else // !STM32L4xx
+#if FLASH_HALF_PAGES
+/**
+ * @brief   Programs one half page in a single cycle. That part runs from RAM
+ * (.RamFunc), the flash can't be read while the words are loaded, so the
+ * source must be in RAM as well.
+ * @param   address: First address of the half page, FLASH_HALF_PAGE_SIZE aligned.
+ * @param   *data:   FLASH_HALF_PAGE_SIZE bytes of data.
+ * @return  status: Report about the success of the writing.
+ */
+static flash_status flash_write_half_page(uint32_t address, uint32_t *data)
+{
+  flash_status status = FLASH_OK;
+
+  status |= flash_program_half_page(address, data);
+  for (uint32_t i = 0u; i < (FLASH_HALF_PAGE_SIZE / 4u); i++)
+  {
+    if (data[i] != ((volatile uint32_t *)FLASH_PTR(address))[i])
+    {
+      status |= FLASH_ERROR_READBACK;
+    }
+  }
+
+  return status;
+}
+#endif /* FLASH_HALF_PAGES */
+
 flash_status flash_write(uint32_t address, uint32_t *data, uint32_t length) {
   flash_status status = FLASH_OK;
 
-  HAL_FLASH_Unlock();
+  flash_open();
 
   /* Loop through the array. */
   for (uint32_t i = 0u; (i < length) && (FLASH_OK == status); i++)
@@ -170,15 +986,26 @@ flash_status flash_write(uint32_t address, uint32_t *data, uint32_t length) {
     {
       status |= FLASH_ERROR_SIZE;
     }
+#if FLASH_HALF_PAGES
+    /* Aligned half pages from RAM in one cycle, the unaligned head and tail
+     * word by word. */
+    else if ((0u == (address & (FLASH_HALF_PAGE_SIZE - 1u))) &&
+             ((length - i) >= (FLASH_HALF_PAGE_SIZE / 4u)) &&
+             ((FLASH_APP_END_ADDRESS - address) >= (FLASH_HALF_PAGE_SIZE - 1u)) &&
+             ((uintptr_t)&data[i] >= SRAM_BASE))
+    {
+      status |= flash_write_half_page(address, &data[i]);
+      address += FLASH_HALF_PAGE_SIZE;
+      i += (FLASH_HALF_PAGE_SIZE / 4u) - 1u;
+    }
+#endif
     else
     {
       /* The actual flashing. If there is an error, then report it. */
-      if (HAL_OK != HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address, data[i])) {
-        status |= FLASH_ERROR_WRITE;
-      }
+      status |= flash_program(address, &data[i]);
       /* Read back the content of the memory. If it is wrong, then report an
        * error. */
-      if (((data[i])) != (*(volatile uint32_t *)address))
+      if (((data[i])) != (*(volatile uint32_t *)FLASH_PTR(address)))
       {
         status |= FLASH_ERROR_READBACK;
       }
@@ -188,7 +1015,7 @@ flash_status flash_write(uint32_t address, uint32_t *data, uint32_t length) {
     }
   }
 
-  HAL_FLASH_Lock();
+  flash_close();
 
   return status;
 }
@@ -206,7 +1033,7 @@ flash_status flash_write_halfword(uint32_t address, uint16_t *data,
 {
   flash_status status = FLASH_OK;
 
-  HAL_FLASH_Unlock();
+  flash_open();
 
   /* Loop through the array. */
   for (uint32_t i = 0u; (i < length) && (FLASH_OK == status); i++)
@@ -220,14 +1047,10 @@ flash_status flash_write_halfword(uint32_t address, uint16_t *data,
     else
     {
       /* The actual flashing. If there is an error, then report it. */
-      if (HAL_OK !=
-          HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, address, data[i]))
-      {
-        status |= FLASH_ERROR_WRITE;
-      }
+      status |= flash_program_halfword(address, data[i]);
       /* Read back the content of the memory. If it is wrong, then report an
        * error. */
-      if (((data[i])) != (*(volatile uint16_t *)address))
+      if (((data[i])) != (*(volatile uint16_t *)FLASH_PTR(address)))
       {
         status |= FLASH_ERROR_READBACK;
       }
@@ -237,7 +1060,7 @@ flash_status flash_write_halfword(uint32_t address, uint16_t *data,
     }
   }
 
-  HAL_FLASH_Lock();
+  flash_close();
 
   return status;
 }
@@ -256,13 +1079,18 @@ void flash_jump_to_app(void)
     NVIC_SystemReset();
   }
 
+  /* Never leave the flash unlocked to the application. */
+  flash_session_abort();
+
   /* Function pointer to the address of the user application. */
   fnc_ptr jump_to_app;
-  jump_to_app = (fnc_ptr)(*(volatile uint32_t *)(FLASH_APP_START_ADDRESS + 4u));
+  jump_to_app = (fnc_ptr)(uintptr_t)(*(volatile uint32_t *)FLASH_PTR(FLASH_APP_START_ADDRESS + 4u));
   /* Remove configs before jump. */
   HAL_DeInit();
   /* Change the main stack pointer. */
-  asm volatile("msr msp, %0" ::"g"(*(volatile uint32_t *)FLASH_APP_START_ADDRESS));
+#if defined(__arm__)
+  asm volatile("msr msp, %0" ::"g"(*(volatile uint32_t *)FLASH_PTR(FLASH_APP_START_ADDRESS)));
+#endif
   SCB->VTOR = (__IO uint32_t)(FLASH_APP_START_ADDRESS);
   //__set_MSP(*(volatile uint32_t *)FLASH_APP_START_ADDRESS);
   jump_to_app();
@@ -273,10 +1101,17 @@ void flash_jump_to_app(void)
 
 int8_t flash_check_app_loaded(void)
 {
+#if FLASH_SESSION
+  /* The last update was interrupted or the image is damaged. */
+  if (flash_session_active() || (flash_image_check() < 0))
+  {
+    return -1;
+  }
+#endif
   /* Check if app is already loaded */
-  uintptr_t app_stack = *(volatile uintptr_t *)(FLASH_APP_START_ADDRESS);
-  uintptr_t app_reset = *(volatile uintptr_t *)(FLASH_APP_START_ADDRESS + 4u);
-  uintptr_t app_nmi = *(volatile uintptr_t *)(FLASH_APP_START_ADDRESS + 8u);
+  uint32_t app_stack = *(volatile uint32_t *)FLASH_PTR(FLASH_APP_START_ADDRESS);
+  uint32_t app_reset = *(volatile uint32_t *)FLASH_PTR(FLASH_APP_START_ADDRESS + 4u);
+  uint32_t app_nmi = *(volatile uint32_t *)FLASH_PTR(FLASH_APP_START_ADDRESS + 8u);
   if (((uint8_t)(app_stack >> 24) == 0x20) &&
       ((uint8_t)(app_reset >> 24) == 0x08) &&
       ((uint8_t)(app_nmi >> 24) == 0x08)) {
@@ -23,9 +23,17 @@
 #endif
 #include <stdint.h>
 
+/* Memory mapped access to the flash. All reads of the flash contents go
+ * through this, a host build of the modules can map its simulated flash. */
+#ifndef FLASH_PTR
+#define FLASH_PTR(address) ((uintptr_t)(address))
+#endif
+
 /* Extern vertor start address */
+#ifndef BL_FLASH_START
 extern uint32_t g_pfnVectors;
 #define BL_FLASH_START ((__IO uint32_t)&g_pfnVectors)
+#endif
 
 /* Application space offset */
 #ifndef FLASH_APP_OFFSET
@@ -68,10 +76,75 @@ uint32_t get_flash_end(void);
 #define FLASH_ERROR_READBACK 0x04u /**< Writing was successful, but the content of the memory is wrong. */
 #define FLASH_ERROR 0xFFu           /**< Generic error. */
 
+/* Content of an erased flash word. */
+#if defined(STM32L0xx) || defined(STM32L1xx)
+#define FLASH_ERASED_WORD 0x00000000u
+#else
+#define FLASH_ERASED_WORD 0xFFFFFFFFu
+#endif
+
+/* L0: program aligned runs of 16 words as one half page. */
+#if defined(STM32L0xx)
+#ifndef FLASH_HALF_PAGES
+#define FLASH_HALF_PAGES 1
+#endif
+#define FLASH_HALF_PAGE_SIZE 64u
+#endif
+
+/* Number of application pages tracked by flash_update(). */
+#ifndef FLASH_ERASE_MAP_PAGES
+#define FLASH_ERASE_MAP_PAGES 512u
+#endif
+
+/* Page write-back cache for the writers with small chunks (STK500, FrSky):
+ * a page is collected in RAM and erased and programmed once. */
+#ifndef FLASH_CACHE
+#if STK500 || FRSKY
+#define FLASH_CACHE 1
+#else
+#define FLASH_CACHE 0
+#endif
+#endif
+
+/* Keep a record of the running update in the page below the application,
+ * so an interrupted upload can be resumed and is never started. Only used if
+ * that page is not part of the bootloader image. */
+#ifndef FLASH_SESSION
+#define FLASH_SESSION 1
+#endif
+#define FLASH_SESSION_ADDRESS (FLASH_APP_START_ADDRESS - FLASH_PAGE_SIZE)
+
+/* A completed session leaves this descriptor in the session page. The image
+ * is only started if its CRC-32 matches, the first boot that checked it adds
+ * the verified mark so later boots don't read the whole image again. */
+#define FLASH_IMAGE_MAGIC 0x31474D49u    /* "IMG1" */
+#define FLASH_IMAGE_VERIFIED 0x59465256u /* "VRFY" */
+
+typedef struct {
+  uint32_t magic;          /**< FLASH_IMAGE_MAGIC. */
+  uint32_t length;         /**< Size of the image, multiple of 4 bytes. */
+  uint32_t crc;            /**< CRC-32 of the image (see crc.h). */
+  uint32_t version;        /**< Given by the host, 0 if unknown. */
+  uint32_t verified;       /**< FLASH_IMAGE_VERIFIED once checked. */
+  uint32_t verified_check; /**< ~verified. */
+} flash_image;
+
 typedef uint8_t flash_status;
 
 flash_status flash_erase(uint32_t address);
 flash_status flash_erase_page(uint32_t address);
+void flash_erase_reset(void);
+flash_status flash_update(uint32_t address, uint32_t *data, uint32_t length);
+void flash_update_stats(uint32_t *kept, uint32_t *blank);
+flash_status flash_cache_write(uint32_t address, const uint8_t *data, uint32_t length);
+flash_status flash_cache_flush(void);
+flash_status flash_erase_tail(uint32_t address);
+flash_status flash_session_begin(uint32_t size, uint32_t id);
+uint32_t flash_session_resume(uint32_t size, uint32_t id);
+flash_status flash_session_commit(uint32_t offset);
+flash_status flash_session_end(uint32_t length, uint32_t crc, uint32_t version);
+void flash_session_abort(void);
+uint32_t flash_image_crc(uint32_t length);
 flash_status flash_write(uint32_t address, uint32_t *data, uint32_t length);
 flash_status flash_write_halfword(uint32_t address, uint16_t *data,
                                   uint32_t length);
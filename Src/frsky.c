@@ -2,6 +2,7 @@
 #include "uart.h"
 #include "main.h"
 #include "flash.h"
+#include "crc.h"
 
 #include <string.h>
 
@@ -54,6 +55,10 @@ enum rx_state
 
 static uint_fast8_t flash_ongoing = 0;
 static uint32_t address_offset = 0;
+/* Set by PRIM_CMD_DOWNLOAD, words are only taken inside a session */
+static uint_fast8_t download_ongoing = 0;
+/* CRC-32 of the image words as received, checked against the flash */
+static uint32_t image_crc = CRC32_INIT;
 
 /* frame[0..6 = data][7 = crc] */
 uint8_t frame[FRAME_SIZE];
@@ -119,7 +124,7 @@ void send_command(const uint8_t command)
 void send_address(void)
 {
     uint8_t *ptr = startFrame(PRIM_REQ_DATA_ADDR);
-    *((uint32_t *)ptr) = address_offset;
+    memcpy(ptr, &address_offset, sizeof(address_offset));
     send_frame();
 }
 
@@ -161,22 +166,43 @@ void process_frame(const uint8_t first)
         case PRIM_CMD_DOWNLOAD:
             // start upload, give file offset
             address_offset = 0;
+            image_crc = CRC32_INIT;
+            // the application is invalid until PRIM_DATA_EOF
+            if (flash_session_begin(0, 0) != FLASH_OK)
+            {
+                /* nothing can be written, don't ask for the image */
+                flash_session_abort();
+                download_ongoing = 0;
+                return;
+            }
+            download_ongoing = 1;
             send_address();
             break;
         case PRIM_DATA_WORD:
         {
             /* Check that address is correct */
-            if (frame[6] == (address_offset & 0xff))
+            if (download_ongoing && (frame[6] == (address_offset & 0xff)))
             {
                 if (FRSKY_HEADER_SIZE <= address_offset)
                 {
-                    uint32_t data = *((uint32_t *)(&frame[2]));
-                    uint32_t tgt_addr = FLASH_APP_START_ADDRESS +
-                                        (address_offset - FRSKY_HEADER_SIZE);
-                    if ((tgt_addr & (FLASH_PAGE_SIZE - 1)) == 0)
-                        flash_erase_page(tgt_addr);
-                    if (flash_write(tgt_addr, &data, 1) != FLASH_OK)
+                    /* Image bigger than the application area */
+                    if ((address_offset - FRSKY_HEADER_SIZE) >
+                        (FLASH_APP_END_ADDRESS - FLASH_APP_START_ADDRESS - 3))
+                        return;
+                    /* collected per flash page, erased and written once */
+                    if (flash_cache_write(FLASH_APP_START_ADDRESS +
+                                              (address_offset - FRSKY_HEADER_SIZE),
+                                          &frame[2], 4) != FLASH_OK)
+                    {
+                        /* the image is broken, stop answering */
+                        flash_session_abort();
+                        download_ongoing = 0;
                         return;
+                    }
+                    /* words come in order, a repeated one has the old address */
+                    uint32_t word;
+                    memcpy(&word, &frame[2], sizeof(word));
+                    image_crc = crc32_update(image_crc, &word, 1);
                 }
                 address_offset += 4;
                 send_address();
@@ -184,7 +210,18 @@ void process_frame(const uint8_t first)
             break;
         }
         case PRIM_DATA_EOF:
+            if (download_ongoing && (FRSKY_HEADER_SIZE <= address_offset))
+            {
+                uint32_t length = address_offset - FRSKY_HEADER_SIZE;
+                /* the flash has to hold exactly what was received */
+                if (flash_cache_flush() == FLASH_OK &&
+                    flash_image_crc(length) == image_crc)
+                    flash_session_end(length, image_crc, 0);
+                else
+                    flash_session_abort();
+            }
             send_command(PRIM_END_DOWNLOAD);
+            download_ongoing = 0;
             flash_ongoing = 0;
             break;
         default:
@@ -203,6 +240,7 @@ void readFrame(void)
     uint8_t data, rx_state, len;
 
 start_read:
+    frame_ptr = frame;
     rx_state = STATE_DATA_IN_FRAME;
     // check tx byte
     if (uart_receive_timeout(&data, 1, 10) != UART_OK ||
@@ -237,7 +275,7 @@ start_read:
 
         len = (frame_ptr - frame);
 
-        if (len == FRAME_SIZE ||
+        if (len >= FRAME_SIZE ||
             (len == 7 && data == 0xff))
         {
             process_frame((data == 0xff));
@@ -253,6 +291,10 @@ int8_t frsky_check(void)
     uint8_t led_state = 1;
     uint8_t data;
 
+    /* nothing carries over from an earlier call, like after a reset */
+    flash_ongoing = 0;
+    download_ongoing = 0;
+
     while (1)
     {
         data = 0;
@@ -0,0 +1,154 @@
+/**
+ * @file    lzss.c
+ * @brief   Streaming LZSS (heatshrink format) decompressor.
+ */
+
+#include "lzss.h"
+
+/* Decoder states, named after the field being read. */
+#define LZSS_STATE_TAG     0u
+#define LZSS_STATE_LITERAL 1u
+#define LZSS_STATE_INDEX   2u
+#define LZSS_STATE_COUNT   3u
+
+/* History window, also the output buffer (aligned for the flash writes). */
+static uint8_t lzss_window[LZSS_WINDOW_SIZE] __attribute__((aligned(8)));
+static uint16_t lzss_head;      /**< Next position in the window. */
+static uint32_t lzss_output;    /**< Bytes produced since lzss_init(). */
+static uint16_t lzss_field;     /**< Bits of the field being read. */
+static uint8_t lzss_field_bits; /**< Bits still missing from the field. */
+static uint8_t lzss_state;      /**< Field being read. */
+static uint16_t lzss_offset;    /**< Distance of the pending back reference. */
+static lzss_status lzss_result; /**< Sticky sink error. */
+static lzss_sink lzss_output_sink;
+
+/**
+ * @brief   Appends a byte to the window, hands the window to the sink when it
+ * is full.
+ * @param   byte: Decompressed byte.
+ * @return  void
+ */
+static inline void lzss_put(uint8_t byte)
+{
+  lzss_window[lzss_head++] = byte;
+  lzss_output++;
+  if (LZSS_WINDOW_SIZE == lzss_head)
+  {
+    lzss_head = 0u;
+    if (0u != lzss_output_sink(&lzss_window[0u], LZSS_WINDOW_SIZE))
+    {
+      lzss_result = LZSS_ERROR;
+    }
+  }
+}
+
+/**
+ * @brief   Starts a new stream.
+ * @param   sink: Receiver of the decompressed data.
+ * @return  void
+ */
+void lzss_init(lzss_sink sink)
+{
+  for (uint32_t i = 0u; i < LZSS_WINDOW_SIZE; i++)
+  {
+    lzss_window[i] = 0u;
+  }
+  lzss_head = 0u;
+  lzss_output = 0u;
+  lzss_field = 0u;
+  lzss_field_bits = 1u;
+  lzss_state = LZSS_STATE_TAG;
+  lzss_offset = 0u;
+  lzss_result = LZSS_OK;
+  lzss_output_sink = sink;
+}
+
+/**
+ * @brief   Decompresses the next chunk of the stream. Chunks can be split at
+ * any byte.
+ * @param   *data:  Compressed data.
+ * @param   length: Size of the data.
+ * @return  status: LZSS_ERROR if the sink failed (now or earlier).
+ */
+lzss_status lzss_decode(const uint8_t *data, uint32_t length)
+{
+  for (uint32_t i = 0u; (i < length) && (LZSS_OK == lzss_result); i++)
+  {
+    uint8_t byte = data[i];
+
+    for (uint8_t mask = 0x80u; 0u != mask; mask >>= 1u)
+    {
+      lzss_field = (uint16_t)(lzss_field << 1u) | ((byte & mask) ? 1u : 0u);
+      if (0u != --lzss_field_bits)
+      {
+        continue;
+      }
+
+      switch (lzss_state)
+      {
+      case LZSS_STATE_TAG:
+        lzss_state = lzss_field ? LZSS_STATE_LITERAL : LZSS_STATE_INDEX;
+        lzss_field_bits = lzss_field ? 8u : LZSS_WINDOW_BITS;
+        break;
+      case LZSS_STATE_LITERAL:
+        lzss_put((uint8_t)lzss_field);
+        lzss_state = LZSS_STATE_TAG;
+        lzss_field_bits = 1u;
+        break;
+      case LZSS_STATE_INDEX:
+        lzss_offset = lzss_field + 1u;
+        lzss_state = LZSS_STATE_COUNT;
+        lzss_field_bits = LZSS_LOOKAHEAD_BITS;
+        break;
+      default:
+        /* Copy, source and destination may overlap (runs). */
+        for (uint16_t count = lzss_field + 1u; 0u != count; count--)
+        {
+          lzss_put(lzss_window[(lzss_head - lzss_offset) & (LZSS_WINDOW_SIZE - 1u)]);
+        }
+        lzss_state = LZSS_STATE_TAG;
+        lzss_field_bits = 1u;
+        break;
+      }
+      lzss_field = 0u;
+    }
+  }
+
+  return lzss_result;
+}
+
+/**
+ * @brief   Hands the rest of the window to the sink, padded to 8 bytes.
+ *          Leftover padding bits of the stream are ignored.
+ * @param   fill: Value of the padding bytes.
+ * @return  status: LZSS_ERROR if the sink failed (now or earlier).
+ */
+lzss_status lzss_finish(uint8_t fill)
+{
+  uint16_t length = lzss_head;
+
+  if ((LZSS_OK == lzss_result) && (0u != length))
+  {
+    while (length & 7u)
+    {
+      lzss_window[length++] = fill;
+    }
+    if (0u != lzss_output_sink(&lzss_window[0u], length))
+    {
+      lzss_result = LZSS_ERROR;
+    }
+    lzss_head = 0u;
+  }
+
+  return lzss_result;
+}
+
+/**
+ * @brief   Number of decompressed bytes since lzss_init(), without padding.
+ * @param   void
+ * @return  Size of the output.
+ */
+uint32_t lzss_output_size(void)
+{
+  return lzss_output;
+}
@@ -0,0 +1,41 @@
+/**
+ * @file    lzss.h
+ * @brief   Streaming LZSS decompressor for compressed firmware uploads.
+ *
+ *          The bit stream is the heatshrink format (MSB first):
+ *            1 + 8 bits:     literal byte.
+ *            0 + W + L bits: copy (L + 1) bytes from (W + 1) bytes back.
+ *          The history window doubles as the output buffer, every time it
+ *          wraps the whole window is handed to the sink, so the decoder needs
+ *          (1 << W) bytes of RAM and nothing else.
+ */
+
+#ifndef LZSS_H_
+#define LZSS_H_
+
+#include <stdint.h>
+
+/* Window (W) and back reference length (L) bits, the host has to match. */
+#ifndef LZSS_WINDOW_BITS
+#define LZSS_WINDOW_BITS 8u
+#endif
+#ifndef LZSS_LOOKAHEAD_BITS
+#define LZSS_LOOKAHEAD_BITS 4u
+#endif
+#define LZSS_WINDOW_SIZE (1u << LZSS_WINDOW_BITS)
+
+/* Status report for the functions. */
+#define LZSS_OK 0x00u    /**< The action was successful. */
+#define LZSS_ERROR 0x01u /**< The sink refused the output. */
+
+typedef uint8_t lzss_status;
+
+/* Receives decompressed data, multiple of 8 bytes, returns 0 on success. */
+typedef uint8_t (*lzss_sink)(uint8_t *data, uint16_t length);
+
+void lzss_init(lzss_sink sink);
+lzss_status lzss_decode(const uint8_t *data, uint32_t length);
+lzss_status lzss_finish(uint8_t fill);
+uint32_t lzss_output_size(void);
+
+#endif /* LZSS_H_ */
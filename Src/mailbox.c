@@ -0,0 +1,45 @@
+/**
+ * @file    mailbox.c
+ * @brief   Update request from the application, see mailbox.h.
+ */
+
+#include "mailbox.h"
+#include "main.h"
+
+/* Placed by the linker script at the end of the RAM. */
+extern boot_mailbox _boot_mailbox;
+
+#if XMODEM
+#define BOOT_MAILBOX_SELF BOOT_MAILBOX_XMODEM
+#elif STK500
+#define BOOT_MAILBOX_SELF BOOT_MAILBOX_STK500
+#else
+#define BOOT_MAILBOX_SELF BOOT_MAILBOX_FRSKY
+#endif
+
+/**
+ * @brief   Checks and consumes the update request. It is replaced by the
+ * reset flags in any case, the next reset boots normally again.
+ * @param   *baud: Requested baud rate, 0 if none.
+ * @param   reset: RCC CSR at reset, left for the application.
+ * @return  1 if an update was requested, 0 otherwise.
+ */
+uint8_t mailbox_take(uint32_t *baud, uint32_t reset)
+{
+  volatile boot_mailbox *mailbox = &_boot_mailbox;
+  uint8_t requested = 0u;
+
+  if ((BOOT_MAILBOX_MAGIC == mailbox->magic) &&
+      (~(mailbox->magic ^ mailbox->protocol ^ mailbox->baud) == mailbox->check) &&
+      ((BOOT_MAILBOX_ANY == mailbox->protocol) || (BOOT_MAILBOX_SELF == mailbox->protocol)))
+  {
+    *baud = mailbox->baud;
+    requested = 1u;
+  }
+
+  mailbox->magic = BOOT_MAILBOX_RESET;
+  mailbox->protocol = reset;
+  mailbox->baud = 0u;
+  mailbox->check = ~(BOOT_MAILBOX_RESET ^ reset);
+  return requested;
+}
@@ -0,0 +1,45 @@
+/**
+ * @file    mailbox.h
+ * @brief   Update request left by the application in the last 16 bytes of
+ *          the RAM. The bootloader stack starts below it and nothing clears
+ *          it, so the request survives a software reset.
+ *
+ *          Application side:
+ *            boot_mailbox *mb = (boot_mailbox *)(RAM end - 16);
+ *            mb->magic = BOOT_MAILBOX_MAGIC;
+ *            mb->protocol = BOOT_MAILBOX_ANY;
+ *            mb->baud = 0;  (or the rate the host will use)
+ *            mb->check = ~(mb->magic ^ mb->protocol ^ mb->baud);
+ *            NVIC_SystemReset();
+ *
+ *          The bootloader reads and clears the RCC reset flags. It leaves
+ *          them for the application in the same place: magic is
+ *          BOOT_MAILBOX_RESET, protocol the RCC CSR at reset, baud 0 and
+ *          check as above. The application has to read them before its
+ *          stack reaches the end of the RAM.
+ */
+
+#ifndef MAILBOX_H_
+#define MAILBOX_H_
+
+#include <stdint.h>
+
+#define BOOT_MAILBOX_MAGIC ((uint32_t)0x424F4F54u) /* "BOOT" */
+#define BOOT_MAILBOX_RESET ((uint32_t)0x52535420u) /* "RST " */
+
+/* Requested upload protocol, a request for another one is ignored. */
+#define BOOT_MAILBOX_ANY    0u
+#define BOOT_MAILBOX_XMODEM 1u
+#define BOOT_MAILBOX_STK500 2u
+#define BOOT_MAILBOX_FRSKY  3u
+
+typedef struct {
+  uint32_t magic;    /**< BOOT_MAILBOX_MAGIC. */
+  uint32_t protocol; /**< BOOT_MAILBOX_... */
+  uint32_t baud;     /**< Baud rate of the session, 0 keeps the default. */
+  uint32_t check;    /**< ~(magic ^ protocol ^ baud). */
+} boot_mailbox;
+
+uint8_t mailbox_take(uint32_t *baud, uint32_t reset);
+
+#endif /* MAILBOX_H_ */
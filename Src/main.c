@@ -24,6 +24,8 @@
 #include "led.h"
 #include "uart.h"
 #include "flash.h"
+#include "crc.h"
+#include "mailbox.h"
 #if XMODEM
 #include "xmodem.h"
 #elif STK500
@@ -37,6 +39,15 @@
 /* Private typedef -----------------------------------------------------------*/
 
 /* Private define ------------------------------------------------------------*/
+#define STACK_PAINT 0xC5C5C5C5u
+
+/* Listen window after a power-on, brown-out or watchdog reset (ms) when
+ * nothing asks for an update: no mailbox request, button or break on the RX
+ * line. A connected host only gets the normal window if it asks, a host that
+ * is sending already still gets in. */
+#ifndef BOOT_COLD_WAIT
+#define BOOT_COLD_WAIT 5u
+#endif
 
 /* Private macro -------------------------------------------------------------*/
 
@@ -69,6 +80,7 @@ uint32_t duplex_pin;
 #endif // BUTTON_INVERTED
 
 /* Private function prototypes -----------------------------------------------*/
+static void stack_paint(void);
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
 
@@ -160,6 +172,54 @@ void duplex_state_set(const enum duplex_state state)
 #endif
 }
 
+/**
+ * @brief  Reads and clears the reset cause, a power-on flag left set would
+ *         make every later reset look like a power cycle. The application
+ *         gets the flags through the mailbox (mailbox_take()).
+ * @param  *flags: RCC CSR as it was at reset.
+ * @retval 1 after a software reset (update requested by the application) or
+ *         the reset pin alone, 0 after a power cycle or a watchdog.
+ */
+static uint8_t boot_warm_reset(uint32_t *flags)
+{
+  uint8_t warm = 0;
+
+  *flags = RCC->CSR;
+  if (__HAL_RCC_GET_FLAG(RCC_FLAG_SFTRST)) {
+    warm = 1;
+  }
+  /* A power-on pulls the reset pin too */
+  else if (__HAL_RCC_GET_FLAG(RCC_FLAG_PINRST)
+#if defined(RCC_FLAG_PORRST)
+           && !__HAL_RCC_GET_FLAG(RCC_FLAG_PORRST)
+#endif
+#if defined(RCC_FLAG_BORRST)
+           && !__HAL_RCC_GET_FLAG(RCC_FLAG_BORRST)
+#endif
+  ) {
+    warm = 1;
+  }
+  __HAL_RCC_CLEAR_RESET_FLAGS();
+  return warm;
+}
+
+/**
+ * @brief  Checks the signals that ask for an update at power-on and take no
+ *         waiting: the button, or the host holding the RX line low (break).
+ *         A host that is merely connected doesn't count.
+ * @param  void
+ * @retval 1 if an update is asked for.
+ */
+static uint8_t boot_update_signal(void)
+{
+#if defined(PIN_BUTTON)
+  if (!!BTN_READ() ^ BUTTON_INVERTED) {
+    return 1;
+  }
+#endif
+  return uart_rx_break();
+}
+
 #if XMODEM
 
 static void print_boot_header(void)
@@ -183,14 +243,33 @@ static void boot_code(void)
   uint32_t ticks;
   uint8_t BLrequested = 0, ledState = 0;
   uint8_t header[6] = {0, 0, 0, 0, 0, 0};
+  uint32_t baud = 0u;
+  uint16_t wait = UART_TIMEOUT;
+  uint32_t reset;
+  uint8_t warm = boot_warm_reset(&reset);
+
+  /* Update requested by the application, no handshake needed */
+  if (mailbox_take(&baud, reset)) {
+    if (0u != baud) {
+      (void)uart_baud_set(baud);
+    }
+    goto start_upload;
+  }
 
-  print_boot_header();
-  /* If the button is pressed, then jump to the user application,
-   * otherwise stay in the bootloader. */
-  uart_transmit_str((uint8_t *)"Send '2bl', 'bbb' or hold down button\n\r");
+  if (warm || boot_update_signal()) {
+    print_boot_header();
+    /* If the button is pressed, then jump to the user application,
+     * otherwise stay in the bootloader. */
+    uart_transmit_str((uint8_t *)"Send '2bl', 'bbb' or hold down button\n\r");
+  } else {
+    /* Cold boot, nothing asks for an update. Only wait if a host is
+     * sending already. */
+    wait = BOOT_COLD_WAIT;
+  }
 
   /* Wait input from UART */
-  if (uart_receive(header, 5u) == UART_OK) {
+  if ((uart_receive_timeout(header, 1u, wait) == UART_OK) &&
+      (uart_receive(&header[1], 4u) == UART_OK)) {
     /* Search for magic strings */
     BLrequested = (strstr((char *)header, "bbb") || strstr((char *)header, "2bl")) ? 1 : 0;
   }
@@ -272,6 +351,7 @@ static void boot_code(void)
     }
   }
 
+start_upload:
   /* Infinite loop */
   while (1)
   {
@@ -287,16 +367,29 @@ static void boot_code(void)
 #define BOOT_WAIT 300 // ms
 
 static uint32_t boot_end_time;
+static uint8_t boot_requested; /* Wait until the upload is done */
 
 int8_t timer_end(void)
 {
   //return 0;
-  return (HAL_GetTick() > boot_end_time);
+  return !boot_requested && (HAL_GetTick() > boot_end_time);
 }
 
 static void boot_code(void)
 {
-  boot_end_time = HAL_GetTick() + BOOT_WAIT;
+  uint32_t baud = 0u;
+  uint32_t reset;
+  uint8_t warm = boot_warm_reset(&reset);
+  uint32_t wait;
+
+  /* Update requested by the application */
+  boot_requested = mailbox_take(&baud, reset);
+  if (boot_requested && (0u != baud)) {
+    (void)uart_baud_set(baud);
+  }
+
+  wait = (boot_requested || warm || boot_update_signal()) ? BOOT_WAIT : BOOT_COLD_WAIT;
+  boot_end_time = HAL_GetTick() + wait;
 
   /* Infinite loop */
   while (1)
@@ -317,6 +410,38 @@ static void boot_code(void)
 
 #endif /* XMODEM */
 
+/* Linker symbols, the stack grows down from _estack towards the bss. */
+extern uint32_t _ebss;
+extern uint32_t _estack;
+
+/**
+ * @brief  Fills the free RAM below the stack with a known pattern.
+ * @param  void
+ * @retval void
+ */
+static void stack_paint(void)
+{
+  /* Keep clear of the frame of this function */
+  uint32_t *top = (uint32_t *)(__get_MSP() - 32u);
+  for (uint32_t *ptr = &_ebss; ptr < top; ptr++) {
+    *ptr = STACK_PAINT;
+  }
+}
+
+/**
+ * @brief  Measures the deepest stack use since reset.
+ * @param  void
+ * @retval Bytes of the stack that were used.
+ */
+uint32_t stack_peak(void)
+{
+  uint32_t *ptr = &_ebss;
+  while ((ptr < &_estack) && (STACK_PAINT == *ptr)) {
+    ptr++;
+  }
+  return (uint32_t)&_estack - (uint32_t)ptr;
+}
+
 /**
  * @brief  The application entry point.
  * @retval int
@@ -328,6 +453,9 @@ int main(void)
   /* Make sure the vectors are set correctly */
   SCB->VTOR = BL_FLASH_START;
 
+  /* Watermark for stack_peak() */
+  stack_paint();
+
   /* Reset of all peripherals, Initializes the Flash interface and the
    * Systick.
    */
@@ -341,6 +469,7 @@ int main(void)
   MX_GPIO_Init();
 
   uart_init();
+  crc_init();
 
   led_state_set(LED_BOOTING);
   boot_code();
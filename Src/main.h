@@ -101,6 +101,7 @@ void Error_Handler(void);
 void led_state_set(uint32_t state);
 void duplex_state_set(const enum duplex_state state);
 int8_t timer_end(void);
+uint32_t stack_peak(void);
 
 void gpio_port_pin_get(uint32_t io, void ** port, uint32_t * pin);
 void gpio_port_clock(uint32_t port);
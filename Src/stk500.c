@@ -7,20 +7,25 @@
 
 #include "stk500.h"
 #include "flash.h"
+#include "crc.h"
 #include "uart.h"
 #include "main.h"
 
 #define OPTIBOOT_MAJVER 4
 #define OPTIBOOT_MINVER 5
 
-uint32_t Buff[128];
+uint32_t Buff[128] __attribute__((aligned(8)));
 uint8_t insync;
+static uint8_t rx_timeout; // set by getch(), checked by the long reads
 
 uint8_t getch(void)
 {
   uint8_t ch = 0;
   if (uart_receive_timeout(&ch, 1u, 100) == UART_ERROR)
+  {
+    rx_timeout = 1;
     return UART_ERROR;
+  }
   return ch;
 }
 
@@ -47,6 +52,10 @@ void bgetNch(uint8_t count)
 static int8_t stk500_update(void)
 {
   uint32_t address = 0;
+  uint32_t image_end = 0; // end of the written image, 0 before the first page
+  flash_status flash_error = FLASH_OK; // sticky, the upload fails at the end
+  uint32_t image_crc = CRC32_INIT; // CRC-32 of the pages as received
+  uint32_t crc_end = FLASH_APP_START_ADDRESS; // end of the pages in image_crc
   uint8_t ch, GPIOR0, led = 1;
   int8_t retval;
   int8_t initial_sync = 0;
@@ -132,40 +141,66 @@ static int8_t stk500_update(void)
       uint8_t *bufPtr;
       uint16_t page_size; // page_size
       uint16_t count;
-      uint8_t *memAddress;
+      uint32_t memAddress;
       // read page size, 2 bytes
+      rx_timeout = 0;
       page_size = getch() << 8; /* getlen() */
       page_size |= getch();
       getch(); // discard flash/eeprom byte
       // While that is going on, read in page contents
-      count = page_size;
       bufPtr = (uint8_t *)Buff;
-      do
+      for (count = 0; (count < page_size) && !rx_timeout &&
+                      (page_size <= sizeof(Buff)); count++)
       {
         *bufPtr++ = getch();
-      } while (--count);
-      if (page_size & 1)
+      }
+      // a page that doesn't fit or a silent line fails the upload, nothing
+      // is drained at 100 ms a byte
+      if (rx_timeout || (sizeof(Buff) < page_size))
       {
-        *bufPtr = 0xFF;
+        flash_session_abort();
+        uart_transmit_ch(STK_FAILED);
+        return -1;
       }
-      count = page_size;
-      count += 1;
-      count /= 4;
-      memAddress = (uint8_t *)(address + FLASH_APP_START_ADDRESS);
+      memAddress = address + FLASH_APP_START_ADDRESS;
 
       // Read command terminator, start reply
       verifySpace();
 
-      if ((uint32_t)memAddress < FLASH_APP_END_ADDRESS)
+      if (page_size == 0)
       {
-        if ((uint32_t)memAddress >= FLASH_APP_START_ADDRESS)
+        // nothing to write
+      }
+      else if (memAddress < FLASH_APP_END_ADDRESS)
+      {
+        if (memAddress >= FLASH_APP_START_ADDRESS)
         {
-          if (((uint32_t)memAddress & (FLASH_PAGE_SIZE - 1)) == 0)
+          // the application is invalid until the programming ends, if the
+          // session can't be started nothing is written and the pages fail
+          if (!image_end)
           {
-            // At page start so erase it
-            flash_erase_page((uint32_t)memAddress);
+            flash_error |= flash_session_begin(0, 0);
+          }
+          if (image_end < (memAddress + page_size))
+          {
+            image_end = memAddress + page_size;
+          }
+          // collected per flash page, erased and written once
+          if (flash_error == FLASH_OK)
+          {
+            flash_error |= flash_cache_write(memAddress, (uint8_t *)Buff, page_size);
+          }
+          // avrdude sends whole word pages in order, anything else can't be
+          // checked against the flash and fails the upload
+          if ((memAddress == crc_end) && !(page_size & 3))
+          {
+            image_crc = crc32_update(image_crc, Buff, page_size / 4);
+            crc_end += page_size;
+          }
+          else
+          {
+            crc_end = 0;
           }
-          flash_write((uint32_t)memAddress, Buff, count);
         }
       }
     }
@@ -173,17 +208,26 @@ static int8_t stk500_update(void)
     {
       uint16_t length;
       uint8_t xlen;
-      uint8_t *memAddress;
-      memAddress = (uint8_t *)(address + FLASH_BASE);
       // READ PAGE - we only read flash
       xlen = getch(); /* getlen() */
       length = getch() | (xlen << 8);
       getch();
       verifySpace();
-      do
+      // pages still in the cache are read back from the flash
+      flash_error |= flash_cache_flush();
+      // send the flash part in one go, 0xFF past the end of the flash
+      if ((address + FLASH_BASE) <= FLASH_APP_END_ADDRESS)
+      {
+        uint32_t valid = FLASH_APP_END_ADDRESS - (address + FLASH_BASE) + 1;
+        if (valid > length)
+          valid = length;
+        uart_transmit_bytes((uint8_t *)FLASH_PTR(address + FLASH_BASE), valid);
+        length -= valid;
+      }
+      while (length--)
       {
-        uart_transmit_ch(*memAddress++);
-      } while (--length);
+        uart_transmit_ch(0xFF);
+      }
     }
     else if (ch == STK_READ_SIGN)
     {
@@ -197,6 +241,26 @@ static int8_t stk500_update(void)
     { /* 'Q' */
       // Adaboot no-wait mod
       verifySpace();
+      if (image_end)
+      {
+        image_end -= FLASH_APP_START_ADDRESS;
+        flash_error |= flash_cache_flush();
+        // the flash has to hold exactly what was received
+        if ((crc_end != (image_end + FLASH_APP_START_ADDRESS)) ||
+            (flash_image_crc(image_end) != image_crc))
+        {
+          flash_error |= FLASH_ERROR_READBACK;
+        }
+        if (flash_error == FLASH_OK)
+        {
+          flash_error |= flash_session_end(image_end, image_crc, 0);
+        }
+        else
+        {
+          // the application stays invalid
+          flash_session_abort();
+        }
+      }
       retval = -1; // flash end, boot to app
     }
     else
@@ -209,7 +273,7 @@ static int8_t stk500_update(void)
     }
 
     if (insync)
-      uart_transmit_ch(STK_OK);
+      uart_transmit_ch((flash_error == FLASH_OK) ? STK_OK : STK_FAILED);
   }
 
   return retval;
@@ -33,6 +33,118 @@ static UART_HandleTypeDef huart_tx;
 #define UART_BAUD 420000
 #endif
 
+/* Largest accepted baud rate error (per mille). */
+#ifndef UART_BAUD_TOLERANCE
+#define UART_BAUD_TOLERANCE 20u
+#endif
+
+#if !defined(USART_CR1_OVER8)
+#define USART_CR1_OVER8 0u // F1: 16x oversampling only
+#endif
+
+#if USART_USE_LL
+static uint32_t uart_baud = UART_BAUD; /**< Current baud rate. */
+static uint32_t uart_over8; /**< USART_CR1_OVER8 if the current rate needs it. */
+#endif
+
+static GPIO_TypeDef *uart_rx_port; /**< RX pin, for uart_rx_break(). */
+static uint32_t uart_rx_pin;
+
+/* Longest break waited out by uart_rx_break() (ms). */
+#ifndef UART_BREAK_MAX
+#define UART_BREAK_MAX 100u
+#endif
+
+#if UART_RX_BUFFER_SIZE
+#if !USART_USE_LL
+#error "DMA reception requires USART_USE_LL"
+#endif
+static uint8_t uart_rx_buffer[UART_RX_BUFFER_SIZE]; /**< DMA receive ring. */
+static uint32_t uart_rx_tail; /**< Next byte to be read from the ring. */
+static DMA_Channel_TypeDef *uart_rx_dma;
+
+/**
+ * @brief   Returns the ring position the DMA will write next.
+ * @param   void
+ * @return  head: Index into uart_rx_buffer.
+ */
+static uint32_t uart_rx_head(void)
+{
+  uint32_t head = UART_RX_BUFFER_SIZE - uart_rx_dma->CNDTR;
+  return (head < UART_RX_BUFFER_SIZE) ? head : 0u;
+}
+
+/**
+ * @brief   Starts the circular DMA reception of USARTx into the ring.
+ * @param   *USARTx: The receiving USART.
+ * @return  void
+ */
+static void uart_rx_dma_init(USART_TypeDef *USARTx)
+{
+  /* RX channel and (L0/L4) request number of the USART. */
+  uint32_t channel = 0u, request = 0u;
+
+#if defined(STM32L0xx)
+  if (USARTx == USART1) {
+    channel = 3u;
+    request = 3u;
+  } else if (USARTx == USART2) {
+    channel = 6u;
+    request = 4u;
+  }
+#else // F1, F3, L4
+  if (USARTx == USART1) {
+    channel = 5u;
+  } else if (USARTx == USART2) {
+    channel = 6u;
+  }
+#if defined(USART3)
+  else if (USARTx == USART3) {
+    channel = 3u;
+  }
+#endif
+  request = 2u; // L4 only
+#endif
+
+  switch (channel) {
+  case 3u:
+    uart_rx_dma = DMA1_Channel3;
+    break;
+  case 5u:
+    uart_rx_dma = DMA1_Channel5;
+    break;
+  case 6u:
+    uart_rx_dma = DMA1_Channel6;
+    break;
+  default:
+    Error_Handler();
+    return;
+  }
+
+  __HAL_RCC_DMA1_CLK_ENABLE();
+#if defined(DMA1_CSELR)
+  MODIFY_REG(DMA1_CSELR->CSELR, 0xFu << (4u * (channel - 1u)),
+             request << (4u * (channel - 1u)));
+#else
+  (void)request;
+#endif
+
+  uart_rx_dma->CCR = 0u;
+#if defined(STM32F1)
+  uart_rx_dma->CPAR = (uint32_t)&USARTx->DR;
+#else
+  uart_rx_dma->CPAR = (uint32_t)&USARTx->RDR;
+#endif
+  uart_rx_dma->CMAR = (uint32_t)uart_rx_buffer;
+  uart_rx_dma->CNDTR = UART_RX_BUFFER_SIZE;
+  /* Peripheral to memory, bytes, memory increment, circular. */
+  uart_rx_dma->CCR = DMA_CCR_PL_1 | DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_EN;
+  uart_rx_tail = 0u;
+
+  LL_USART_EnableDMAReq_RX(USARTx);
+}
+#endif // UART_RX_BUFFER_SIZE
+
 #if defined(DEBUG_UART) && defined(STM32F1)
 #if (DEBUG_UART == UART_NUM)
 #error "Same uart cannot be used for debug and comminucation!"
@@ -105,13 +217,36 @@ uart_status uart_receive_timeout(uint8_t *data, uint16_t length, uint16_t timeou
 {
 #if HALF_DUPLEX
 #if USART_USE_LL
-  UART_handle->CR1 = USART_CR1_UE | USART_CR1_RE;
+  UART_handle->CR1 = USART_CR1_UE | USART_CR1_RE | uart_over8;
 #else
   HAL_HalfDuplex_EnableReceiver(&huart1);
 #endif
 #endif
 
-#if USART_USE_LL
+#if UART_RX_BUFFER_SIZE
+  uint32_t tickstart = HAL_GetTick();
+  while (length--) {
+    while (uart_rx_tail == uart_rx_head()) {
+#if !defined(STM32F1)
+      /* An overrun blocks the DMA requests on these USARTs. */
+      if (LL_USART_IsActiveFlag_ORE(UART_handle)) {
+        LL_USART_ClearFlag_ORE(UART_handle);
+      }
+#endif
+      /* Check for the Timeout */
+      if (timeout != HAL_MAX_DELAY) {
+        if ((timeout == 0U) || ((HAL_GetTick() - tickstart) > timeout)) {
+          return UART_ERROR;
+        }
+      }
+    }
+    *data++ = uart_rx_buffer[uart_rx_tail++];
+    if (UART_RX_BUFFER_SIZE <= uart_rx_tail) {
+      uart_rx_tail = 0u;
+    }
+  }
+  return UART_OK;
+#elif USART_USE_LL
   uint32_t tickstart = HAL_GetTick();
   while (length--) {
     while (!LL_USART_IsActiveFlag_RXNE(UART_handle)) {
@@ -166,7 +301,7 @@ uart_status uart_transmit_bytes(uint8_t *data, uint32_t len)
   duplex_state_set(DUPLEX_TX);
 #if HALF_DUPLEX
 #if USART_USE_LL
-  UART_TX_HANDLE->CR1 = USART_CR1_UE | USART_CR1_TE;
+  UART_TX_HANDLE->CR1 = USART_CR1_UE | USART_CR1_TE | uart_over8;
 #else
   HAL_HalfDuplex_EnableTransmitter(&UART_TX_HANDLE);
 #endif
@@ -180,6 +315,10 @@ uart_status uart_transmit_bytes(uint8_t *data, uint32_t len)
   }
   while (!LL_USART_IsActiveFlag_TC(UART_TX_HANDLE))
     ;
+#if HALF_DUPLEX && UART_RX_BUFFER_SIZE
+  /* Drop anything the receiver picked up from the shared line. */
+  uart_rx_tail = uart_rx_head();
+#endif
   status = UART_OK;
 #else
   if (HAL_OK == HAL_UART_Transmit(&UART_TX_HANDLE, data, len, UART_TIMEOUT)) {
@@ -191,18 +330,202 @@ uart_status uart_transmit_bytes(uint8_t *data, uint32_t len)
 }
 
 #if USART_USE_LL
-static void usart_hw_init(USART_TypeDef *USARTx, uint32_t dir) {
-  uint32_t pclk = SystemCoreClock / 2;
-#if defined(STM32F1)
-  LL_USART_SetBaudRate(USARTx, pclk, UART_BAUD);
+/**
+ * @brief   Kernel clock of the USART as set up by SystemClock_Config().
+ * @param   *USARTx: The USART.
+ * @return  Clock frequency in Hz.
+ */
+static uint32_t uart_clock(USART_TypeDef *USARTx)
+{
+#if defined(STM32F3xx)
+  /* USART1 is switched to PCLK1 as well. */
+  (void)USARTx;
+  return HAL_RCC_GetPCLK1Freq();
 #else
-  LL_USART_SetBaudRate(USARTx, pclk, LL_USART_OVERSAMPLING_16, UART_BAUD);
+  return (USARTx == USART1) ? HAL_RCC_GetPCLK2Freq() : HAL_RCC_GetPCLK1Freq();
+#endif
+}
+
+/**
+ * @brief   Calculates the BRR value of a baud rate. Uses 8x oversampling if the
+ * divider gets too small for 16x (not on F1).
+ * @param   *USARTx: The USART.
+ * @param   baud:    Requested baud rate.
+ * @param   *over8:  USART_CR1_OVER8 or 0 (output).
+ * @return  BRR value, 0 if the rate can't be hit within UART_BAUD_TOLERANCE.
+ */
+static uint32_t uart_calc_brr(USART_TypeDef *USARTx, uint32_t baud, uint32_t *over8)
+{
+  uint32_t pclk = uart_clock(USARTx);
+  uint32_t div, brr;
+
+  if (0u == baud) {
+    return 0u;
+  }
+  /* 16x oversampling: BRR = pclk / baud. */
+  div = (pclk + (baud / 2u)) / baud;
+  brr = div;
+  *over8 = 0u;
+#if !defined(STM32F1)
+  if (16u > div) {
+    /* 8x oversampling: USARTDIV = 2 * pclk / baud, BRR[3:0] = USARTDIV[3:0] >> 1. */
+    pclk *= 2u;
+    div = (pclk + (baud / 2u)) / baud;
+    brr = (div & 0xFFF0u) | ((div & 0xFu) >> 1u);
+    *over8 = USART_CR1_OVER8;
+  }
 #endif
+  if ((16u > div) || (0xFFFFu < div)) {
+    return 0u;
+  }
+  /* Resulting rate has to be close enough. */
+  uint32_t actual = pclk / div;
+  uint32_t error = (actual > baud) ? (actual - baud) : (baud - actual);
+  if (((uint64_t)error * 1000u) > ((uint64_t)baud * UART_BAUD_TOLERANCE)) {
+    return 0u;
+  }
+  return brr;
+}
+
+/**
+ * @brief   Programs the baud rate of an USART, the USART is disabled meanwhile.
+ * @param   *USARTx: The USART.
+ * @param   brr:     BRR value.
+ * @param   over8:   USART_CR1_OVER8 or 0.
+ * @return  void
+ */
+static void usart_set_brr(USART_TypeDef *USARTx, uint32_t brr, uint32_t over8)
+{
+  uint32_t cr1 = USARTx->CR1;
+  USARTx->CR1 = cr1 & ~USART_CR1_UE;
+  USARTx->BRR = brr;
+  USARTx->CR1 = (cr1 & ~USART_CR1_OVER8) | over8;
+}
+
+static void usart_hw_init(USART_TypeDef *USARTx, uint32_t dir) {
+  uint32_t brr = uart_calc_brr(USARTx, uart_baud, &uart_over8);
+  if (0u == brr) {
+    Error_Handler();
+  }
   LL_USART_ConfigAsyncMode(USARTx);
-  USARTx->CR1 = USART_CR1_UE | dir; //| USART_CR1_RE | USART_CR1_TE;
+  USARTx->CR1 = dir | uart_over8;
+  USARTx->BRR = brr;
+  USARTx->CR1 = USART_CR1_UE | dir | uart_over8; //| USART_CR1_RE | USART_CR1_TE;
 }
 #endif // USART_USE_LL
 
+/**
+ * @brief   Returns the current baud rate.
+ * @param   void
+ * @return  Baud rate.
+ */
+uint32_t uart_baud_get(void)
+{
+#if USART_USE_LL
+  return uart_baud;
+#else
+  return UART_BAUD;
+#endif
+}
+
+/**
+ * @brief   Checks if a baud rate can be used with the current clocks.
+ * @param   baud: Baud rate.
+ * @return  status: UART_OK if uart_baud_set() would succeed.
+ */
+uart_status uart_baud_check(uint32_t baud)
+{
+#if USART_USE_LL
+  uint32_t over8_rx, over8_tx;
+  if ((0u != uart_calc_brr(UART_handle, baud, &over8_rx)) &&
+      (0u != uart_calc_brr(UART_TX_HANDLE, baud, &over8_tx)) &&
+      (over8_rx == over8_tx)) {
+    return UART_OK;
+  }
+#else
+  (void)baud;
+#endif
+  return UART_ERROR;
+}
+
+/**
+ * @brief   Switches to another baud rate once the transmission is complete.
+ * @param   baud: Baud rate.
+ * @return  status: UART_ERROR if the rate can't be used, nothing is changed.
+ */
+uart_status uart_baud_set(uint32_t baud)
+{
+#if USART_USE_LL
+  uint32_t over8;
+  if (UART_OK != uart_baud_check(baud)) {
+    return UART_ERROR;
+  }
+  while (!LL_USART_IsActiveFlag_TC(UART_TX_HANDLE))
+    ;
+  usart_set_brr(UART_handle, uart_calc_brr(UART_handle, baud, &over8), over8);
+#if TARGET_GHOST_RX_V1_2 || TARGET_R9SLIM_PLUS
+  usart_set_brr(UART_TX_HANDLE, uart_calc_brr(UART_TX_HANDLE, baud, &over8), over8);
+#endif
+  uart_over8 = over8;
+  uart_baud = baud;
+  return UART_OK;
+#else
+  (void)baud;
+  return UART_ERROR;
+#endif
+}
+
+/**
+ * @brief   Drops everything received so far.
+ * @param   void
+ * @return  void
+ */
+void uart_flush(void)
+{
+#if UART_RX_BUFFER_SIZE
+  uart_rx_tail = uart_rx_head();
+#elif USART_USE_LL
+  while (LL_USART_IsActiveFlag_RXNE(UART_handle)) {
+    (void)LL_USART_ReceiveData8(UART_handle);
+  }
+#endif
+}
+
+/**
+ * @brief   Reads the level of the RX pin.
+ * @param   void
+ * @return  1 if the line is high (idle or open, the pin has a pull-up).
+ */
+static uint8_t uart_rx_high(void)
+{
+#if GPIO_USE_LL
+  return LL_GPIO_IsInputPinSet(uart_rx_port, uart_rx_pin) ? 1u : 0u;
+#else
+  return (GPIO_PIN_SET == HAL_GPIO_ReadPin(uart_rx_port, (uint16_t)uart_rx_pin)) ? 1u : 0u;
+#endif
+}
+
+/**
+ * @brief   Checks if the host holds the RX line low (a break) to ask for an
+ *          update. An idle or open line reads high, so this takes one pin
+ *          read on a normal boot. A break is waited out, at most
+ *          UART_BREAK_MAX ms, and the byte it was received as is dropped.
+ * @param   void
+ * @return  1 if the line was low, 0 otherwise.
+ */
+uint8_t uart_rx_break(void)
+{
+  uint32_t start = HAL_GetTick();
+
+  if (uart_rx_high()) {
+    return 0u;
+  }
+  while (!uart_rx_high() && ((HAL_GetTick() - start) < UART_BREAK_MAX)) {
+  }
+  uart_flush();
+  return 1u;
+}
+
 /**
  * @brief UART Initialization Function
  * @param None
@@ -262,6 +585,8 @@ void uart_init(void)
   GPIO_InitStruct.Pin = GPIO_PIN_2;
   HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
 #endif // GPIO_USE_LL
+  uart_rx_port = GPIOB;
+  uart_rx_pin = (GPIO_USE_LL ? LL_GPIO_PIN_6 : GPIO_PIN_6);
 
 #if USART_USE_LL
   usart_hw_init(USART2, USART_CR1_TE); // TX, half duplex
@@ -270,6 +595,9 @@ void uart_init(void)
   usart_hw_init(USART1, USART_CR1_RE); // RX, half duplex
   LL_USART_EnableHalfDuplex(USART1);
   UART_handle = USART1;
+#if UART_RX_BUFFER_SIZE
+  uart_rx_dma_init(USART1);
+#endif
 #else // !USART_USE_LL
   /* Init TX UART */
   huart_tx.Instance = USART2;
@@ -313,6 +641,8 @@ void uart_init(void)
   gpio_port_clock((uint32_t)GPIOB);
   LL_GPIO_SetPinMode(GPIOB, LL_GPIO_PIN_11, LL_GPIO_MODE_INPUT);
   LL_GPIO_SetPinPull(GPIOB, LL_GPIO_PIN_11, LL_GPIO_PULL_UP);
+  uart_rx_port = GPIOB;
+  uart_rx_pin = (GPIO_USE_LL ? LL_GPIO_PIN_11 : GPIO_PIN_11);
 
   /* UART TX pin config */
   gpio_port_clock((uint32_t)GPIOA);
@@ -324,6 +654,9 @@ void uart_init(void)
   UART_TX_HANDLE = USART1;
   usart_hw_init(USART3, USART_CR1_RE); // RX, half duplex
   UART_handle = USART3;
+#if UART_RX_BUFFER_SIZE
+  uart_rx_dma_init(USART3);
+#endif
 
 #else //!TARGET_GHOST_RX_V1_2 && !TARGET_R9SLIM_PLUS
   USART_TypeDef * uart_ptr;
@@ -403,6 +736,8 @@ void uart_init(void)
 #endif
 
   gpio_port_clock((uint32_t)gpio_ptr);
+  uart_rx_port = gpio_ptr;
+  uart_rx_pin = pin_rx;
 
 #if GPIO_USE_LL
   /* RX pin */
@@ -490,6 +825,9 @@ void uart_init(void)
 #if USART_USE_LL
   UART_handle = uart_ptr;
   usart_hw_init(uart_ptr, (USART_CR1_TE | USART_CR1_RE));
+#if UART_RX_BUFFER_SIZE
+  uart_rx_dma_init(uart_ptr);
+#endif
 #else // USART_USE_LL
   huart1.Instance = uart_ptr;
   huart1.Init.BaudRate = UART_BAUD;
@@ -15,6 +15,16 @@
 /* Timeout for HAL. */
 #define UART_TIMEOUT ((uint16_t)2000u)
 
+/* Size of the DMA fed receive ring. Bytes keep arriving while the CPU is
+ * busy (e.g. flashing), 0 means polled reception (HAL builds). */
+#ifndef UART_RX_BUFFER_SIZE
+#if USART_USE_LL
+#define UART_RX_BUFFER_SIZE 4096u
+#else
+#define UART_RX_BUFFER_SIZE 0u
+#endif
+#endif
+
 /* Status report for the functions. */
 typedef enum
 {
@@ -27,6 +37,11 @@ uart_status uart_receive_timeout(uint8_t *data, uint16_t length, uint16_t timeou
 uart_status uart_transmit_str(uint8_t *data);
 uart_status uart_transmit_ch(uint8_t data);
 uart_status uart_transmit_bytes(uint8_t *data, uint32_t len);
+uint32_t uart_baud_get(void);
+uart_status uart_baud_check(uint32_t baud);
+uart_status uart_baud_set(uint32_t baud);
+void uart_flush(void);
+uint8_t uart_rx_break(void);
 
 void uart_init(void);
 
@@ -8,7 +8,15 @@
  */
 
 #include "xmodem.h"
+#include "crc.h"
+#include "lzss.h"
+#include "delta.h"
 #include "main.h"
+#include <string.h>
+
+/* X_CMD_SEEK skips whole packets and whole pages. flash_update() erases a
+ * page before its first write, so a page has to be sent in full. */
+#define X_SEEK_UNIT ((FLASH_PAGE_SIZE > X_PACKET_1024_SIZE) ? FLASH_PAGE_SIZE : X_PACKET_1024_SIZE)
 
 uint16_t flashcounter;
 
@@ -16,10 +24,53 @@ uint16_t flashcounter;
 static uint8_t xmodem_packet_number; /**< Packet number counter. */
 static uint32_t xmodem_actual_flash_address; /**< Address where we have to write. */
 static uint8_t x_first_packet_received; /**< First packet or not. */
+/* Data of the last verified packet, received in place and handed to the flash
+ * as is (doubleword aligned for the L4 programming). */
+static uint8_t xmodem_packet_data[X_PACKET_1024_SIZE] __attribute__((aligned(8)));
+static uint16_t xmodem_packet_size; /**< Size of the last verified packet. */
+static uint8_t xmodem_received_number; /**< Number of the last received packet. */
+static uint8_t xmodem_session; /**< Flash session record started. */
+static uint8_t xmodem_resumable; /**< Log the progress for X_CMD_RESUME. */
+static xmodem_stats xmodem_session_stats; /**< Counters for X_CMD_STATS. */
+static uint32_t xmodem_start_tick; /**< HAL tick of the first packet. */
+static uint32_t xmodem_image_version; /**< Version for the image descriptor. */
+static uint32_t xmodem_image_crc; /**< CRC-32 of the image in the flash so far. */
+static uint32_t xmodem_sparse_size; /**< Image size of an X_CMD_SEEK update, 0 otherwise. */
+static uint32_t xmodem_image_size; /**< Announced size of the image, 0 if it ends with the packets. */
+static uint8_t xmodem_extended; /**< The host speaks the extended commands, it reads the EOT digest. */
+#if XMODEM_PIPELINE
+static xmodem_status xmodem_flash_status; /**< Result of the deferred flashing. */
+#endif
+#if (XMODEM_WINDOW_MAX > 1)
+static uint8_t xmodem_window; /**< Negotiated window, 1 = plain Xmodem. */
+static uint8_t xmodem_window_unacked; /**< Good packets not acknowledged yet. */
+static uint8_t xmodem_window_resync; /**< Dropping packets until the NAKed one. */
+static uint8_t xmodem_window_reply[2]; /**< Pending ACK/NAK and packet number. */
+#endif
+#if XMODEM_COMPRESSION
+static uint8_t xmodem_compressed; /**< Packets carry an LZSS stream. */
+static uint32_t xmodem_compressed_left; /**< Stream bytes still expected, the rest is padding. */
+static uint32_t xmodem_stream_size; /**< Announced size of the decompressed stream. */
+#endif
+#if XMODEM_DELTA
+static uint8_t xmodem_delta; /**< The (decompressed) stream is a patch. */
+#endif
 
 /* Local functions. */
 static uint16_t xmodem_calc_crc(uint8_t *data, uint16_t length);
 static xmodem_status xmodem_handle_packet(uint8_t size);
+static xmodem_status xmodem_flash_packet(void);
+static uint8_t xmodem_write(uint8_t *data, uint16_t length);
+static xmodem_status xmodem_finish(void);
+static xmodem_status xmodem_handle_command(void);
+static void xmodem_send_reply(uint8_t id, const uint8_t *data, uint16_t length);
+static uint32_t xmodem_get_u32(const uint8_t *data);
+static uint8_t xmodem_flash_range(uint32_t address, uint32_t length);
+static void xmodem_nak(void);
+#if (XMODEM_WINDOW_MAX > 1)
+static xmodem_status xmodem_window_packet(xmodem_status packet_status);
+static void xmodem_window_flush(void);
+#endif
 static xmodem_status xmodem_error_handler(uint8_t *error_number,
                                           uint8_t max_error_number);
 
@@ -39,15 +90,53 @@ void xmodem_receive(void) {
   x_first_packet_received = false;
   xmodem_packet_number = 1u;
   xmodem_actual_flash_address = FLASH_APP_START_ADDRESS;
+  xmodem_session = false;
+  xmodem_resumable = false;
+  xmodem_image_version = 0u;
+  xmodem_image_crc = CRC32_INIT;
+  xmodem_sparse_size = 0u;
+  xmodem_image_size = 0u;
+  xmodem_extended = false;
+  memset(&xmodem_session_stats, 0, sizeof(xmodem_session_stats));
+  flash_erase_reset();
+#if XMODEM_PIPELINE
+  xmodem_flash_status = X_OK;
+#endif
+#if (XMODEM_WINDOW_MAX > 1)
+  xmodem_window = 1u;
+  xmodem_window_unacked = 0u;
+  xmodem_window_resync = false;
+  xmodem_window_reply[0u] = 0u;
+#endif
+#if XMODEM_COMPRESSION
+  xmodem_compressed = false;
+#endif
+#if XMODEM_DELTA
+  xmodem_delta = false;
+#endif
 
   /* Loop until there isn't any error (or until we jump to the user
    * application). */
   while (X_OK == status) {
     uint8_t header = 0x00u;
+    uint16_t timeout = 1000u;
+
+#if (XMODEM_WINDOW_MAX > 1)
+    /* Answer a windowed burst as soon as the line goes idle. */
+    if (xmodem_window_reply[0u]) {
+      timeout = XMODEM_WINDOW_IDLE;
+    }
+#endif
 
     /* Get the header from UART. */
-    uart_status comm_status = uart_receive_timeout(&header, 1u, 1000u);
+    uart_status comm_status = uart_receive_timeout(&header, 1u, timeout);
     if (UART_OK != comm_status) {
+#if (XMODEM_WINDOW_MAX > 1)
+      if (xmodem_window_reply[0u]) {
+        xmodem_window_flush();
+        continue;
+      }
+#endif
       /* Spam the host (until we receive something) with ACSII "C", to notify it,
       * we want to use CRC-16. */
       if (false == x_first_packet_received) {
@@ -58,6 +147,9 @@ void xmodem_receive(void) {
       /* Uart timeout or any other errors. */
       else {
         status = xmodem_error_handler(&error_number, X_MAX_ERRORS);
+#if (XMODEM_WINDOW_MAX > 1)
+        xmodem_window_flush();
+#endif
       }
       continue;
     }
@@ -69,36 +161,94 @@ void xmodem_receive(void) {
     /* 128 or 1024 bytes of data. */
     case X_SOH:
     case X_STX:
-      /* If the handling was successful, then send an ACK. */
       packet_status = xmodem_handle_packet(header);
+#if XMODEM_PIPELINE
+      /* A failed write of the previous packet is reported now. */
+      packet_status |= xmodem_flash_status;
+#if (XMODEM_WINDOW_MAX > 1)
+      if (1u < xmodem_window) {
+        packet_status = xmodem_window_packet(packet_status);
+      } else
+#endif
+      /* If the packet is fine, then ACK it and flash it while the DMA
+         receives the next one. */
       if (X_OK == packet_status) {
         (void)uart_transmit_ch(X_ACK);
+        xmodem_flash_status = xmodem_flash_packet();
       }
+#else
+      /* If the handling and flashing was successful, then send an ACK. */
+      if (X_OK == packet_status) {
+        packet_status = xmodem_flash_packet();
+        if (X_OK == packet_status) {
+          (void)uart_transmit_ch(X_ACK);
+        }
+      }
+#endif
       /* If the error was flash related, then immediately set the error counter
          to max (graceful abort). */
-      else if (packet_status & X_ERROR_FLASH) {
+      if (packet_status & X_ERROR_FLASH) {
         error_number = X_MAX_ERRORS;
         status = xmodem_error_handler(&error_number, X_MAX_ERRORS);
       }
       /* Error while processing the packet, either send a NAK or do graceful
          abort. */
-      else {
+      else if (X_OK != packet_status) {
         status = xmodem_error_handler(&error_number, X_MAX_ERRORS);
       }
+      /* Only consecutive errors abort, a noisy line must not end a long
+         transfer. */
+      else {
+        error_number = 0u;
+      }
       break;
     /* End of Transmission. */
     case X_EOT:
-      /* ACK, feedback to user (as a text), then jump to user application. */
-      (void)uart_transmit_ch(X_ACK);
+      /* The last packet could not be written or the image is incomplete,
+         graceful abort. */
+      if (X_OK != xmodem_finish()) {
+        error_number = X_MAX_ERRORS;
+        status = xmodem_error_handler(&error_number, X_MAX_ERRORS);
+        break;
+      }
+      /* ACK (with the digest if the host understands it), feedback to user
+         (as a text), then jump to user application. */
+      if (xmodem_extended) {
+        uint32_t size = xmodem_image_size;
+        uint8_t digest[8u] = {(uint8_t)size, (uint8_t)(size >> 8u), (uint8_t)(size >> 16u), (uint8_t)(size >> 24u),
+                              (uint8_t)xmodem_image_crc, (uint8_t)(xmodem_image_crc >> 8u),
+                              (uint8_t)(xmodem_image_crc >> 16u), (uint8_t)(xmodem_image_crc >> 24u)};
+        xmodem_send_reply(X_EOT_DIGEST, &digest[0u], sizeof(digest));
+      } else {
+        (void)uart_transmit_ch(X_ACK);
+      }
+#if XMODEM_ERASE_TAIL
+      (void)flash_erase_tail(xmodem_actual_flash_address);
+#endif
       //(void)uart_transmit_str((uint8_t *)"\n\rFirmware updated!\n\r");
       //(void)uart_transmit_str((uint8_t *)"Jumping to user application...\n\r");
       flash_jump_to_app();
       break;
+    /* Extended command. */
+    case X_CMD:
+      if (X_OK != xmodem_handle_command()) {
+        status = xmodem_error_handler(&error_number, X_MAX_ERRORS);
+      } else {
+        xmodem_extended = true;
+      }
+      break;
     /* Abort from host. */
     case X_CAN:
       status = X_ERROR;
       break;
     default:
+#if (XMODEM_WINDOW_MAX > 1)
+      /* Junk of a broken windowed burst, the NAK is already pending. */
+      if (xmodem_window_resync) {
+        break;
+      }
+      xmodem_window_resync = (1u < xmodem_window);
+#endif
       /* Wrong header. */
       if (UART_OK == comm_status) {
         status = xmodem_error_handler(&error_number, X_MAX_ERRORS);
@@ -106,6 +256,9 @@ void xmodem_receive(void) {
       break;
     }
   }
+
+  /* Aborted, lock the flash until the next attempt. */
+  flash_session_abort();
 }
 
 /**
@@ -115,31 +268,18 @@ void xmodem_receive(void) {
  * @return  status: The calculated CRC.
  */
 static uint16_t xmodem_calc_crc(uint8_t *data, uint16_t length) {
-  uint16_t crc = 0u;
-
   if (flashcounter % 5 == 0) {
     led_state_set(ledState ? LED_FLASHING : LED_FLASHING_ALT);
     ledState = !ledState;
   }
   flashcounter++;
 
-  while (length) {
-    length--;
-    crc = crc ^ ((uint16_t)*data++ << 8u);
-    for (uint8_t i = 0u; i < 8u; i++) {
-      if (crc & 0x8000u) {
-        crc = (crc << 1u) ^ 0x1021u;
-      } else {
-        crc = crc << 1u;
-      }
-    }
-  }
-  return crc;
+  return crc16_update(0u, data, length);
 }
 
 /**
- * @brief   This function handles the data packet we get from the xmodem
- * protocol.
+ * @brief   This function receives and verifies the data packet we get from the
+ * xmodem protocol.
  * @param   header: SOH or STX.
  * @return  status: Report about the packet.
  */
@@ -148,9 +288,8 @@ static xmodem_status xmodem_handle_packet(uint8_t header)
   xmodem_status status = X_OK;
   uint16_t size = 0u;
 
-  /* 2 bytes for packet number, 1024 for data, 2 for CRC*/
+  /* 2 bytes for packet number, 2 for CRC, the data goes to the packet buffer. */
   uint8_t received_packet_number[X_PACKET_NUMBER_SIZE];
-  uint8_t received_packet_data[X_PACKET_1024_SIZE];
   uint8_t received_packet_crc[X_PACKET_CRC_SIZE];
 
   /* Get the size of the data. */
@@ -170,12 +309,13 @@ static xmodem_status xmodem_handle_packet(uint8_t header)
   uart_status comm_status = UART_OK;
   /* Get the packet number, data and CRC from UART. */
   comm_status |= uart_receive(&received_packet_number[0u], X_PACKET_NUMBER_SIZE);
-  comm_status |= uart_receive(&received_packet_data[0u], size);
+  comm_status |= uart_receive(&xmodem_packet_data[0u], size);
   comm_status |= uart_receive(&received_packet_crc[0u], X_PACKET_CRC_SIZE);
+  xmodem_received_number = received_packet_number[X_PACKET_NUMBER_INDEX];
   /* Merge the two bytes of CRC. */
   uint16_t crc_received = ((uint16_t)received_packet_crc[X_PACKET_CRC_HIGH_INDEX] << 8u) | ((uint16_t)received_packet_crc[X_PACKET_CRC_LOW_INDEX]);
   /* We calculate it too. */
-  uint16_t crc_calculated = xmodem_calc_crc(&received_packet_data[0u], size);
+  uint16_t crc_calculated = xmodem_calc_crc(&xmodem_packet_data[0u], size);
 
   /* Communication error. */
   if (UART_OK != comm_status)
@@ -183,19 +323,7 @@ static xmodem_status xmodem_handle_packet(uint8_t header)
     status |= X_ERROR_UART;
   }
 
-  /* If it is the first packet, then erase the memory. */
-  if ((X_OK == status) && (false == x_first_packet_received))
-  {
-    if (FLASH_OK == flash_erase(FLASH_APP_START_ADDRESS))
-    {
-      x_first_packet_received = true;
-    }
-    else
-    {
-      status |= X_ERROR_FLASH;
-    }
-  }
-  /* Error handling and flashing. */
+  /* Error handling. */
   if (X_OK == status)
   {
     if (xmodem_packet_number != received_packet_number[0u])
@@ -216,18 +344,170 @@ static xmodem_status xmodem_handle_packet(uint8_t header)
     }
   }
 
-  /* Do the actual flashing (if there weren't any errors). */
-  if ((X_OK == status) && (FLASH_OK != flash_write(xmodem_actual_flash_address, (uint32_t*)&received_packet_data[0u], (uint32_t)size/4u)))
+  xmodem_packet_size = size;
+  return status;
+}
+
+/**
+ * @brief   Writes the last verified packet to the flash.
+ *          The pages it covers are erased right before the first write
+ *          that changes them.
+ * @param   void
+ * @return  status: Report about the flashing.
+ */
+static xmodem_status xmodem_flash_packet(void)
+{
+  xmodem_status status = X_OK;
+  uint8_t result = FLASH_OK;
+  uint32_t tick = HAL_GetTick();
+
+  /* Mark the application as incomplete until EOT. */
+  if (false == xmodem_session)
+  {
+    xmodem_session = true;
+    result |= flash_session_begin(0u, 0u);
+  }
+  if (false == x_first_packet_received)
+  {
+    xmodem_start_tick = tick;
+  }
+  x_first_packet_received = true;
+  xmodem_session_stats.packets++;
+  xmodem_session_stats.received += xmodem_packet_size;
+
+#if XMODEM_COMPRESSION
+  /* Decompress the stream part of the packet, the decoder calls
+     xmodem_write() with every full window. */
+  if (xmodem_compressed)
+  {
+    uint32_t length = (xmodem_compressed_left < xmodem_packet_size) ? xmodem_compressed_left : xmodem_packet_size;
+    xmodem_compressed_left -= length;
+    result |= lzss_decode(&xmodem_packet_data[0u], length);
+  }
+  else
+#endif
+  {
+    result |= xmodem_write(&xmodem_packet_data[0u], xmodem_packet_size);
+  }
+
+  if (FLASH_OK != result)
   {
     /* Flashing error. */
     status |= X_ERROR_FLASH;
   }
 
-  /* Raise the packet number and the address counters (if there weren't any errors). */
-  if (X_OK == status)
+  /* Raise the packet number. The packet was accepted, a flashing error aborts
+     the transfer anyway. */
+  xmodem_packet_number++;
+  xmodem_session_stats.flash_time += HAL_GetTick() - tick;
+  return status;
+}
+
+/**
+ * @brief   Writes image data to the next flash address. The pages it covers
+ * are erased right before the first write that changes them, unchanged pages
+ * are left alone. In delta mode the data is a patch.
+ * @param   *data:  Data to be written, multiple of 8 bytes.
+ * @param   length: Size of the data.
+ * @return  status: Report about the flashing, FLASH_OK on success.
+ */
+static uint8_t xmodem_write(uint8_t *data, uint16_t length)
+{
+#if XMODEM_DELTA
+  if (xmodem_delta)
+  {
+    return delta_apply(data, length);
+  }
+#endif
+
+  /* Do the actual flashing, pages are only erased and written if needed. */
+  flash_status status = flash_update(xmodem_actual_flash_address, (uint32_t*)data, (uint32_t)length);
+  /* Digest of what really is in the flash now. Not after an error, the
+     range may not be written or even be past the application area. */
+  if (FLASH_OK == status)
+  {
+    xmodem_image_crc = crc32_update(xmodem_image_crc, (const uint32_t *)FLASH_PTR(xmodem_actual_flash_address), (uint32_t)length/4u);
+  }
+
+  xmodem_actual_flash_address += length;
+  xmodem_session_stats.written += length;
+
+  /* Remember how far the image got. */
+  if ((FLASH_OK == status) && xmodem_resumable)
   {
-    xmodem_packet_number++;
-    xmodem_actual_flash_address += size;
+    status = flash_session_commit(xmodem_actual_flash_address - FLASH_APP_START_ADDRESS);
+  }
+  return status;
+}
+
+/**
+ * @brief   Completes the image at EOT: reports a failed deferred write,
+ * flushes and checks the decompressed image and ends the flash session.
+ * @param   void
+ * @return  status: X_OK if the whole image is in the flash.
+ */
+static xmodem_status xmodem_finish(void)
+{
+  xmodem_status status = X_OK;
+
+#if XMODEM_PIPELINE
+  status |= xmodem_flash_status;
+#endif
+#if XMODEM_COMPRESSION
+  if (xmodem_compressed && (X_OK == status))
+  {
+    if (LZSS_OK != lzss_finish((uint8_t)FLASH_ERASED_WORD))
+    {
+      status |= X_ERROR_FLASH;
+    }
+    /* Truncated stream or a different image than announced. */
+    else if ((0u != xmodem_compressed_left) || (xmodem_stream_size != lzss_output_size()))
+    {
+      status |= X_ERROR;
+    }
+    /* The last window was padded, the digest covers the image only. A
+       compressed patch is handled below. */
+    else if (0u == xmodem_image_size)
+    {
+      xmodem_image_size = xmodem_stream_size;
+      xmodem_image_crc = flash_image_crc(xmodem_image_size);
+    }
+  }
+#endif
+#if XMODEM_DELTA
+  if (xmodem_delta && (X_OK == status))
+  {
+    if (DELTA_OK != delta_finish())
+    {
+      status |= X_ERROR_FLASH;
+    }
+    /* Unchanged pages were never written, read the whole image. */
+    xmodem_image_crc = flash_image_crc(xmodem_image_size);
+  }
+#endif
+  /* Only parts were written, read the whole image. The last run must not
+     stop inside a page of the image, its rest would be erased. */
+  if ((0u != xmodem_sparse_size) && (X_OK == status) &&
+      ((xmodem_actual_flash_address - FLASH_APP_START_ADDRESS) < xmodem_sparse_size) &&
+      (0u != ((xmodem_actual_flash_address - FLASH_APP_START_ADDRESS) % X_SEEK_UNIT)))
+  {
+    status |= X_ERROR;
+  }
+  if ((0u != xmodem_sparse_size) && (X_OK == status))
+  {
+    xmodem_actual_flash_address = FLASH_APP_START_ADDRESS + xmodem_sparse_size;
+    xmodem_image_crc = flash_image_crc(xmodem_sparse_size);
+  }
+  /* Plain uploads end with the last packet. */
+  if (0u == xmodem_image_size)
+  {
+    xmodem_image_size = xmodem_actual_flash_address - FLASH_APP_START_ADDRESS;
+  }
+  /* The application is complete, leave its descriptor. */
+  if ((X_OK == status) &&
+      (FLASH_OK != flash_session_end(xmodem_image_size, xmodem_image_crc, xmodem_image_version)))
+  {
+    status |= X_ERROR_FLASH;
   }
   return status;
 }
@@ -245,6 +525,7 @@ static xmodem_status xmodem_error_handler(uint8_t *error_number,
   xmodem_status status = X_OK;
   /* Raise the error counter. */
   (*error_number)++;
+  xmodem_session_stats.errors++;
   /* If the counter reached the max value, then abort. */
   if ((*error_number) >= max_error_number) {
     /* Graceful abort. */
@@ -254,8 +535,421 @@ static xmodem_status xmodem_error_handler(uint8_t *error_number,
   }
   /* Otherwise send a NAK for a repeat. */
   else {
-    (void)uart_transmit_ch(X_NAK);
+    xmodem_nak();
     status = X_OK;
   }
   return status;
 }
+
+/**
+ * @brief   Asks the host to repeat. In windowed mode the NAK carries the
+ * expected packet number and waits for the line to be idle on half duplex.
+ * @param   void
+ * @return  void
+ */
+static void xmodem_nak(void)
+{
+#if (XMODEM_WINDOW_MAX > 1)
+  if (1u < xmodem_window) {
+    xmodem_window_reply[0u] = X_NAK;
+    xmodem_window_reply[1u] = xmodem_packet_number;
+#if !HALF_DUPLEX
+    xmodem_window_flush();
+#endif
+    return;
+  }
+#endif
+  (void)uart_transmit_ch(X_NAK);
+}
+
+/**
+ * @brief   Receives and executes an extended command frame (X_CMD header
+ * already received).
+ * @param   void
+ * @return  status: X_OK if the command was answered, error otherwise.
+ */
+static xmodem_status xmodem_handle_command(void)
+{
+  uint8_t header[X_CMD_HEADER_SIZE];
+  uint8_t received_crc[X_PACKET_CRC_SIZE];
+  uint8_t *payload = &xmodem_packet_data[0u];
+
+  /* Get the id and length, then the payload into the packet buffer. */
+  if (UART_OK != uart_receive(&header[0u], X_CMD_HEADER_SIZE))
+  {
+    return X_ERROR_UART;
+  }
+  uint16_t length = (uint16_t)header[1u] | ((uint16_t)header[2u] << 8u);
+  if (sizeof(xmodem_packet_data) < length)
+  {
+    return X_ERROR_COMMAND;
+  }
+  if ((UART_OK != uart_receive(payload, length)) ||
+      (UART_OK != uart_receive(&received_crc[0u], X_PACKET_CRC_SIZE)))
+  {
+    return X_ERROR_UART;
+  }
+  uint16_t crc = crc16_update(crc16_update(0u, &header[0u], X_CMD_HEADER_SIZE), payload, length);
+  if (crc != (((uint16_t)received_crc[X_PACKET_CRC_HIGH_INDEX] << 8u) | received_crc[X_PACKET_CRC_LOW_INDEX]))
+  {
+    return X_ERROR_CRC;
+  }
+
+  switch (header[0u])
+  {
+  /* Windowed mode, only before the first packet. */
+  case X_CMD_WINDOW:
+  {
+    uint8_t window = 1u;
+    if ((1u != length) || (false != x_first_packet_received))
+    {
+      return X_ERROR_COMMAND;
+    }
+#if (XMODEM_WINDOW_MAX > 1)
+    window = (XMODEM_WINDOW_MAX < payload[0u]) ? XMODEM_WINDOW_MAX : payload[0u];
+    if (0u == window)
+    {
+      window = 1u;
+    }
+    xmodem_window = window;
+#endif
+    xmodem_send_reply(X_CMD_WINDOW, &window, 1u);
+    break;
+  }
+  /* Continue an interrupted upload of the same image, only plain uploads
+     before the first packet. */
+  case X_CMD_RESUME:
+  {
+    if ((8u != length) || (false != x_first_packet_received) || (false != xmodem_session) ||
+        (0u != xmodem_sparse_size)
+#if XMODEM_COMPRESSION
+        || xmodem_compressed
+#endif
+#if XMODEM_DELTA
+        || xmodem_delta
+#endif
+       )
+    {
+      return X_ERROR_COMMAND;
+    }
+    uint32_t size = xmodem_get_u32(&payload[0u]);
+    uint32_t id = xmodem_get_u32(&payload[4u]);
+    uint32_t offset = flash_session_resume(size, id);
+    if ((0u == offset) && (FLASH_OK != flash_session_begin(size, id)))
+    {
+      return X_ERROR_FLASH;
+    }
+    xmodem_session = true;
+    xmodem_resumable = true;
+    xmodem_actual_flash_address = FLASH_APP_START_ADDRESS + offset;
+    /* The digest covers the part written before too. */
+    xmodem_image_crc = flash_image_crc(offset);
+    uint8_t answer[4u] = {(uint8_t)offset, (uint8_t)(offset >> 8u), (uint8_t)(offset >> 16u), (uint8_t)(offset >> 24u)};
+    xmodem_send_reply(X_CMD_RESUME, &answer[0u], sizeof(answer));
+    break;
+  }
+  /* Statistics of the session so far. */
+  case X_CMD_STATS:
+  {
+    uint32_t *field = &xmodem_session_stats.elapsed;
+    uint8_t answer[sizeof(xmodem_stats)];
+    xmodem_session_stats.elapsed = x_first_packet_received ? (HAL_GetTick() - xmodem_start_tick) : 0u;
+    xmodem_session_stats.baud = uart_baud_get();
+    xmodem_session_stats.stack = stack_peak();
+    flash_update_stats(&xmodem_session_stats.kept, &xmodem_session_stats.blank);
+    for (uint16_t i = 0u; i < sizeof(answer); i += 4u, field++)
+    {
+      answer[i] = (uint8_t)*field;
+      answer[i + 1u] = (uint8_t)(*field >> 8u);
+      answer[i + 2u] = (uint8_t)(*field >> 16u);
+      answer[i + 3u] = (uint8_t)(*field >> 24u);
+    }
+    xmodem_send_reply(X_CMD_STATS, &answer[0u], sizeof(answer));
+    break;
+  }
+  /* Version of the image, stored with its descriptor at EOT. */
+  case X_CMD_VERSION:
+  {
+    if (4u != length)
+    {
+      return X_ERROR_COMMAND;
+    }
+    xmodem_image_version = xmodem_get_u32(&payload[0u]);
+    xmodem_send_reply(X_CMD_VERSION, &payload[0u], 4u);
+    break;
+  }
+  /* Layout of the flash, for the page list of X_CMD_CHECK. */
+  case X_CMD_INFO:
+  {
+    uint32_t info[3u] = {FLASH_PAGE_SIZE, FLASH_APP_START_ADDRESS,
+                         FLASH_APP_END_ADDRESS - FLASH_APP_START_ADDRESS + 1u};
+    uint8_t answer[sizeof(info)];
+    for (uint16_t i = 0u; i < sizeof(answer); i++)
+    {
+      answer[i] = (uint8_t)(info[i / 4u] >> (8u * (i % 4u)));
+    }
+    xmodem_send_reply(X_CMD_INFO, &answer[0u], sizeof(answer));
+    break;
+  }
+  /* Only the changed pages are sent, plain uploads only. */
+  case X_CMD_SEEK:
+  {
+    uint32_t offset = xmodem_get_u32(&payload[0u]);
+    uint32_t size = xmodem_get_u32(&payload[4u]);
+    /* The run sent before has to end on a unit as well. */
+    if ((8u != length) || xmodem_resumable ||
+        (0u != (offset % X_SEEK_UNIT)) ||
+        (0u != ((xmodem_actual_flash_address - FLASH_APP_START_ADDRESS) % X_SEEK_UNIT)) ||
+        (0u == size) || (size < offset) ||
+        ((FLASH_APP_END_ADDRESS - FLASH_APP_START_ADDRESS + 1u) < size)
+#if XMODEM_COMPRESSION
+        || xmodem_compressed
+#endif
+#if XMODEM_DELTA
+        || xmodem_delta
+#endif
+       )
+    {
+      return X_ERROR_COMMAND;
+    }
+    /* flash_update() only touches the pages of the packets. */
+    xmodem_actual_flash_address = FLASH_APP_START_ADDRESS + offset;
+    xmodem_sparse_size = size;
+    xmodem_image_size = size;
+    xmodem_send_reply(X_CMD_SEEK, &payload[0u], 4u);
+    break;
+  }
+  /* Read back a part of the flash. */
+  case X_CMD_READ:
+  {
+    uint32_t address = xmodem_get_u32(&payload[0u]);
+    uint32_t size = xmodem_get_u32(&payload[4u]);
+    if ((8u != length) || (sizeof(xmodem_packet_data) < size) || !xmodem_flash_range(address, size))
+    {
+      return X_ERROR_COMMAND;
+    }
+    xmodem_send_reply(X_CMD_READ, (const uint8_t *)FLASH_PTR(address), (uint16_t)size);
+    break;
+  }
+  /* CRC-32 of flash ranges, the answers replace the ranges in the buffer. */
+  case X_CMD_CHECK:
+  {
+    if ((0u == length) || (0u != (length % 8u)))
+    {
+      return X_ERROR_COMMAND;
+    }
+    for (uint16_t i = 0u; i < length; i += 8u)
+    {
+      uint32_t address = xmodem_get_u32(&payload[i]);
+      uint32_t size = xmodem_get_u32(&payload[i + 4u]);
+      if ((0u != ((address | size) & 3u)) || !xmodem_flash_range(address, size))
+      {
+        return X_ERROR_COMMAND;
+      }
+      uint32_t crc = crc32_update(CRC32_INIT, (const uint32_t *)FLASH_PTR(address), size / 4u);
+      payload[i / 2u] = (uint8_t)crc;
+      payload[(i / 2u) + 1u] = (uint8_t)(crc >> 8u);
+      payload[(i / 2u) + 2u] = (uint8_t)(crc >> 16u);
+      payload[(i / 2u) + 3u] = (uint8_t)(crc >> 24u);
+    }
+    xmodem_send_reply(X_CMD_CHECK, &payload[0u], length / 2u);
+    break;
+  }
+  /* Switch to the first usable baud rate of the host's list, before the first
+     packet. */
+  case X_CMD_BAUD:
+  {
+    uint32_t old_baud = uart_baud_get();
+    uint32_t baud = 0u;
+    if ((0u == length) || (0u != (length % 4u)) || (false != x_first_packet_received))
+    {
+      return X_ERROR_COMMAND;
+    }
+    for (uint16_t i = 0u; i < length; i += 4u)
+    {
+      if (UART_OK == uart_baud_check(xmodem_get_u32(&payload[i])))
+      {
+        baud = xmodem_get_u32(&payload[i]);
+        break;
+      }
+    }
+    uint8_t answer[4u] = {(uint8_t)baud, (uint8_t)(baud >> 8u), (uint8_t)(baud >> 16u), (uint8_t)(baud >> 24u)};
+    xmodem_send_reply(X_CMD_BAUD, &answer[0u], sizeof(answer));
+    if ((0u == baud) || (UART_OK != uart_baud_set(baud)))
+    {
+      break;
+    }
+    /* Confirm the new rate with the echo of the probe. */
+    const uint8_t probe[X_BAUD_PROBE_SIZE] = X_BAUD_PROBE;
+    uint8_t echo[X_BAUD_PROBE_SIZE];
+    uart_flush();
+    if ((UART_OK == uart_receive_timeout(&echo[0u], X_BAUD_PROBE_SIZE, X_BAUD_PROBE_TIMEOUT)) &&
+        (0 == memcmp(&echo[0u], &probe[0u], X_BAUD_PROBE_SIZE)))
+    {
+      (void)uart_transmit_bytes(&echo[0u], X_BAUD_PROBE_SIZE);
+    }
+    else
+    {
+      (void)uart_baud_set(old_baud);
+      uart_flush();
+    }
+    break;
+  }
+#if XMODEM_COMPRESSION
+  /* Compressed image, only before the first packet. */
+  case X_CMD_COMPRESS:
+  {
+    uint8_t params[2u] = {LZSS_WINDOW_BITS, LZSS_LOOKAHEAD_BITS};
+    if ((8u != length) || (false != x_first_packet_received) || xmodem_resumable || (0u != xmodem_sparse_size))
+    {
+      return X_ERROR_COMMAND;
+    }
+    xmodem_compressed_left = xmodem_get_u32(&payload[0u]);
+    xmodem_stream_size = xmodem_get_u32(&payload[4u]);
+    xmodem_compressed = true;
+    lzss_init(xmodem_write);
+    xmodem_send_reply(X_CMD_COMPRESS, &params[0u], sizeof(params));
+    break;
+  }
+#endif
+#if XMODEM_DELTA
+  /* Patch against the installed image, only before the first packet. */
+  case X_CMD_DELTA:
+  {
+    uint8_t page_size[2u] = {(uint8_t)FLASH_PAGE_SIZE, (uint8_t)(FLASH_PAGE_SIZE >> 8u)};
+    uint32_t app_size = FLASH_APP_END_ADDRESS - FLASH_APP_START_ADDRESS + 1u;
+    if ((14u != length) || (false != x_first_packet_received) || xmodem_resumable || (0u != xmodem_sparse_size))
+    {
+      return X_ERROR_COMMAND;
+    }
+    uint32_t image_size = xmodem_get_u32(&payload[4u]);
+    uint32_t old_size = xmodem_get_u32(&payload[8u]);
+    uint16_t old_crc = (uint16_t)payload[12u] | ((uint16_t)payload[13u] << 8u);
+    /* The patch only fits the image it was made for. */
+    if ((app_size < image_size) || (app_size < old_size) ||
+        (old_crc != crc16_update(0u, (const uint8_t *)FLASH_PTR(FLASH_APP_START_ADDRESS), old_size)))
+    {
+      return X_ERROR_COMMAND;
+    }
+    xmodem_delta = true;
+    xmodem_image_size = image_size;
+    /* The patch writes the pages itself, this only marks the image end. */
+    xmodem_actual_flash_address = FLASH_APP_START_ADDRESS + image_size;
+    delta_init(xmodem_get_u32(&payload[0u]), image_size, old_size);
+    xmodem_send_reply(X_CMD_DELTA, &page_size[0u], sizeof(page_size));
+    break;
+  }
+#endif
+  default:
+    return X_ERROR_COMMAND;
+  }
+  return X_OK;
+}
+
+/**
+ * @brief   Sends the answer of an extended command.
+ * @param   id:      Command id.
+ * @param   *data:   Payload of the answer.
+ * @param   length:  Size of the payload.
+ * @return  void
+ */
+static void xmodem_send_reply(uint8_t id, const uint8_t *data, uint16_t length)
+{
+  uint8_t header[1u + X_CMD_HEADER_SIZE] = {X_ACK, id, (uint8_t)length, (uint8_t)(length >> 8u)};
+  uint16_t crc = crc16_update(crc16_update(0u, &header[1u], X_CMD_HEADER_SIZE), data, length);
+  uint8_t crc_bytes[X_PACKET_CRC_SIZE] = {(uint8_t)(crc >> 8u), (uint8_t)crc};
+
+  (void)uart_transmit_bytes(&header[0u], sizeof(header));
+  (void)uart_transmit_bytes((uint8_t *)data, length);
+  (void)uart_transmit_bytes(&crc_bytes[0u], X_PACKET_CRC_SIZE);
+}
+
+/**
+ * @brief   Reads a little endian word of a command payload.
+ * @param   *data: First byte of the word.
+ * @return  The word.
+ */
+static uint32_t xmodem_get_u32(const uint8_t *data)
+{
+  return (uint32_t)data[0u] | ((uint32_t)data[1u] << 8u) |
+         ((uint32_t)data[2u] << 16u) | ((uint32_t)data[3u] << 24u);
+}
+
+/**
+ * @brief   Checks that a range lies in the flash (bootloader and application).
+ * @param   address: First address.
+ * @param   length:  Size of the range.
+ * @return  true if the range can be read.
+ */
+static uint8_t xmodem_flash_range(uint32_t address, uint32_t length)
+{
+  return (BL_FLASH_START <= address) && (address <= FLASH_APP_END_ADDRESS) &&
+         (length <= (FLASH_APP_END_ADDRESS - address + 1u));
+}
+
+#if (XMODEM_WINDOW_MAX > 1)
+/**
+ * @brief   Handles a received packet in windowed mode.
+ *          Good packets are acknowledged (cumulatively) and flashed, a broken
+ *          or unexpected one is NAKed once with the expected number and the
+ *          rest of the burst is dropped until the host goes back to it.
+ * @param   packet_status: Result of xmodem_handle_packet().
+ * @return  status: X_OK if the packet was consumed, error otherwise.
+ */
+static xmodem_status xmodem_window_packet(xmodem_status packet_status)
+{
+  xmodem_status status = X_OK;
+
+  if (X_OK == packet_status)
+  {
+    xmodem_window_resync = false;
+    xmodem_window_reply[0u] = X_ACK;
+    xmodem_window_reply[1u] = xmodem_received_number;
+    xmodem_window_unacked++;
+#if HALF_DUPLEX
+    /* Don't talk into the burst, only answer a full window. */
+    if (xmodem_window <= xmodem_window_unacked)
+#endif
+    {
+      xmodem_window_flush();
+    }
+    xmodem_flash_status = xmodem_flash_packet();
+  }
+  else if (packet_status & X_ERROR_FLASH)
+  {
+    status = packet_status;
+  }
+  else if ((X_ERROR_NUMBER == packet_status) &&
+           ((uint8_t)(xmodem_packet_number - xmodem_received_number - 1u) < xmodem_window))
+  {
+    /* Already written, the host missed our ACK. Repeat it. */
+    if (0u == xmodem_window_reply[0u])
+    {
+      xmodem_window_reply[0u] = X_ACK;
+      xmodem_window_reply[1u] = (uint8_t)(xmodem_packet_number - 1u);
+    }
+  }
+  else if (false == xmodem_window_resync)
+  {
+    /* The error handler queues the NAK. */
+    xmodem_window_resync = true;
+    status = packet_status;
+  }
+  return status;
+}
+
+/**
+ * @brief   Sends the pending windowed mode ACK/NAK.
+ * @param   void
+ * @return  void
+ */
+static void xmodem_window_flush(void)
+{
+  if (xmodem_window_reply[0u])
+  {
+    (void)uart_transmit_bytes(&xmodem_window_reply[0u], sizeof(xmodem_window_reply));
+    xmodem_window_reply[0u] = 0u;
+    xmodem_window_unacked = 0u;
+  }
+}
+#endif /* XMODEM_WINDOW_MAX > 1 */
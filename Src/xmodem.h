@@ -22,6 +22,13 @@
  * Bytes 131-132: CRC
  */
 
+/* Windowed mode (negotiated with X_CMD_WINDOW before the first packet)
+ * The host sends up to "window" packets without waiting. The receiver answers
+ * X_ACK + number of the last good packet (cumulative) and X_NAK + number of
+ * the expected packet, after which the host goes back to that packet.
+ * Half duplex receivers answer once the window is full or the line is idle.
+ */
+
 /* Xmodem (1024 bytes) packet format
  * Byte  0:         Header
  * Byte  1:         Packet number
@@ -33,6 +40,51 @@
 /* Maximum allowed errors (user defined). */
 #define X_MAX_ERRORS ((uint8_t)3u)
 
+/* ACK a packet as soon as it is verified and write it to flash while the
+ * next one arrives. Needs a receive ring that can hold a whole packet. */
+#ifndef XMODEM_PIPELINE
+#define XMODEM_PIPELINE (UART_RX_BUFFER_SIZE >= 1029u)
+#endif
+
+/* Largest window of unacknowledged packets in windowed mode. The receive
+ * ring has to hold all of them while a packet is being flashed. */
+#ifndef XMODEM_WINDOW_MAX
+#if XMODEM_PIPELINE
+#define XMODEM_WINDOW_MAX (UART_RX_BUFFER_SIZE / 1029u)
+#else
+#define XMODEM_WINDOW_MAX 1u
+#endif
+#endif
+
+/* After X_CMD_BAUD both sides switch, the host sends X_BAUD_PROBE at the new
+ * rate and the receiver echoes it. Without the probe (within the timeout, ms)
+ * the receiver goes back to the old rate. */
+#define X_BAUD_PROBE {0x55u, 0xAAu, 0x0Fu, 0xF0u}
+#define X_BAUD_PROBE_SIZE ((uint16_t)4u)
+#define X_BAUD_PROBE_TIMEOUT ((uint16_t)500u)
+
+/* Idle time after which pending windowed mode replies are sent (ms). */
+#define XMODEM_WINDOW_IDLE ((uint16_t)10u)
+
+/* Erase the stale pages behind the new image after EOT. Pages are otherwise
+ * only erased right before the first write that changes them. */
+#ifndef XMODEM_ERASE_TAIL
+#define XMODEM_ERASE_TAIL 0
+#endif
+
+/* Accept compressed images (X_CMD_COMPRESS), costs the LZSS window in RAM.
+ * Off unless the target enables it (platformio.ini), the 8K builds have no
+ * room for the decoder. */
+#ifndef XMODEM_COMPRESSION
+#define XMODEM_COMPRESSION 0
+#endif
+
+/* Accept patches against the installed image (X_CMD_DELTA), costs a flash
+ * page of RAM. Off unless the target enables it (platformio.ini). */
+#ifndef XMODEM_DELTA
+#define XMODEM_DELTA 0
+#endif
+
 /* Sizes of the packets. */
 #define X_PACKET_NUMBER_SIZE  ((uint16_t)2u)
 #define X_PACKET_128_SIZE     ((uint16_t)128u)
@@ -54,6 +106,32 @@
 #define X_CAN ((uint8_t)0x18u)  /**< Cancel. */
 #define X_C   ((uint8_t)0x43u)  /**< ASCII "C" to notify the host we want to use CRC16. */
 
+/* Extended command frame (not part of Xmodem), little endian length:
+ * Host:   X_CMD, id, length (2 bytes), payload, CRC16 over id..payload.
+ * Answer: X_ACK, id, length (2 bytes), payload, CRC16 over id..payload,
+ *         or a single X_NAK if the frame is broken or the command refused.
+ */
+#define X_CMD ((uint8_t)0x05u)  /**< Enquiry, starts an extended command frame. */
+#define X_CMD_HEADER_SIZE ((uint16_t)3u)
+
+/* Extended commands. */
+#define X_CMD_WINDOW ((uint8_t)0x57u)  /**< "W": windowed mode, payload: window size. */
+#define X_CMD_COMPRESS ((uint8_t)0x5Au)  /**< "Z": LZSS packets, payload: stream and decompressed size (4 bytes each). */
+#define X_CMD_RESUME   ((uint8_t)0x52u)  /**< "R": resume, payload: image size and id (4 bytes each), answer: offset to go on from. */
+#define X_CMD_BAUD     ((uint8_t)0x42u)  /**< "B": baud rate, payload: proposed rates (4 bytes each), answer: chosen rate or 0. */
+#define X_CMD_STATS    ((uint8_t)0x53u)  /**< "S": session statistics, answer: xmodem_stats. */
+#define X_CMD_DELTA    ((uint8_t)0x44u)  /**< "D": patch packets, payload: patch, image and old image size (4 bytes each), old image CRC16 (2 bytes). */
+#define X_CMD_VERSION  ((uint8_t)0x56u)  /**< "V": image version for the descriptor, payload: version (4 bytes). */
+#define X_CMD_READ     ((uint8_t)0x46u)  /**< "F": read the flash, payload: address and length (4 bytes each, up to 1024 bytes), answer: the data. */
+#define X_CMD_CHECK    ((uint8_t)0x4Bu)  /**< "K": CRC-32 of flash ranges, payload: address and length pairs (4 bytes each, whole words), answer: CRC-32 per range. */
+#define X_CMD_INFO     ((uint8_t)0x50u)  /**< "P": flash layout, answer: page size, application address and size (4 bytes each). */
+#define X_CMD_SEEK     ((uint8_t)0x41u)  /**< "A": next packets go to an offset, the pages skipped keep their content, payload: offset (whole packets and pages) and image size (4 bytes each). */
+
+/* Once the host sent an extended command, the ACK of EOT is the start of an
+ * answer frame (see above) with the image size and its CRC-32 read back from
+ * the flash (4 bytes each). A plain Xmodem host only gets the ACK. */
+#define X_EOT_DIGEST   ((uint8_t)0x45u)  /**< "E" */
+
 /* Status report for the functions. */
 typedef enum {
   X_OK            = 0x00u, /**< The action was successful. */
@@ -61,9 +139,24 @@ typedef enum {
   X_ERROR_NUMBER  = 0x02u, /**< Packet number mismatch error. */
   X_ERROR_UART    = 0x04u, /**< UART communication error. */
   X_ERROR_FLASH   = 0x08u, /**< Flash related error. */
+  X_ERROR_COMMAND = 0x10u, /**< Broken or refused extended command. */
   X_ERROR         = 0xFFu  /**< Generic error. */
 } xmodem_status;
 
+/* Statistics of the running session (X_CMD_STATS), little endian words. */
+typedef struct {
+  uint32_t elapsed;   /**< ms since the first packet. */
+  uint32_t packets;   /**< Packets taken. */
+  uint32_t errors;    /**< NAKs and timeouts. */
+  uint32_t received;  /**< Payload bytes taken. */
+  uint32_t written;   /**< Image bytes written to the flash. */
+  uint32_t flash_time; /**< ms spent erasing, writing and decoding. */
+  uint32_t baud;      /**< Current baud rate. */
+  uint32_t stack;     /**< Deepest stack use since reset, in bytes. */
+  uint32_t kept;      /**< Pages left alone, the content was identical. */
+  uint32_t blank;     /**< Pages written without an erase. */
+} xmodem_stats;
+
 void xmodem_receive(void);
 
 #endif /* XMODEM_H_ */
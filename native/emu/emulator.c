@@ -0,0 +1,130 @@
+/**
+ * @file    emulator.c
+ * @brief   The bootloader of one target env on a pseudo-terminal, in real
+ *          time: the uploading tools (our uploader, sx, avrdude) flash it
+ *          like the device. The line rate, half duplex turnaround and flash
+ *          timing are those of the target, after each session a line with
+ *          throughput and reply latency is printed (see host_report()).
+ *
+ *          emulator_<env> [--baud rate] [--turnaround us] [--link path] [--image file]
+ */
+
+#include "main.h"
+#include "flash.h"
+#include "uart.h"
+#include "host.h"
+#include "pty_uart.h"
+#if STK500
+#include "stk500.h"
+#elif FRSKY
+#include "frsky.h"
+#else
+#include "xmodem.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Listen window of main.c for STK500 and FrSky (ms). */
+#define EMU_BOOT_WAIT 300u
+
+static const char *const emu_exit[] = {"", "aborted", "started", "reset", "idle"};
+
+/* The protocol loop of main.c, one session. A started application drops
+ * back into the bootloader for the next one. */
+static void emu_session(void)
+{
+#if STK500
+  if (stk500_check() < 0)
+  {
+    flash_jump_to_app();
+  }
+#elif FRSKY
+  if (frsky_check() < 0)
+  {
+    flash_jump_to_app();
+  }
+#else
+  xmodem_receive();
+#endif
+}
+
+/* An installed application, e.g. the base of a delta upload. */
+static int emu_load(const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file)
+  {
+    perror(path);
+    return -1;
+  }
+  size_t size = fread(host_flash_mem(FLASH_APP_START_ADDRESS), 1u,
+                      FLASH_APP_END_ADDRESS - FLASH_APP_START_ADDRESS + 1u, file);
+  fclose(file);
+  printf("%s: %u bytes at 0x%08X\n", path, (unsigned)size, (unsigned)FLASH_APP_START_ADDRESS);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  const char *link = NULL;
+  const char *image = NULL;
+  uint32_t baud = 0u, turnaround = 0u;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if ((0 == strcmp(argv[i], "--baud")) && (i + 1 < argc))
+    {
+      baud = (uint32_t)strtoul(argv[++i], NULL, 0);
+    }
+    else if ((0 == strcmp(argv[i], "--turnaround")) && (i + 1 < argc))
+    {
+      turnaround = (uint32_t)strtoul(argv[++i], NULL, 0);
+    }
+    else if ((0 == strcmp(argv[i], "--link")) && (i + 1 < argc))
+    {
+      link = argv[++i];
+    }
+    else if ((0 == strcmp(argv[i], "--image")) && (i + 1 < argc))
+    {
+      image = argv[++i];
+    }
+    else
+    {
+      fprintf(stderr, "usage: %s [--baud rate] [--turnaround us] [--link path] [--image file]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  host_reset();
+  host_realtime = 1u;
+  if ((image && (0 != emu_load(image))) || (0 != pty_open(link)))
+  {
+    return 1;
+  }
+  if (baud && (UART_OK != uart_baud_set(baud)))
+  {
+    fprintf(stderr, "unsupported rate %u\n", (unsigned)baud);
+    return 2;
+  }
+  host_uart_turnaround_us = turnaround;
+  printf("%s on %s%s%s, %u baud\n", HOST_ENV, pty_name(), link ? " -> " : "", link ? link : "",
+         (unsigned)uart_baud_get());
+  fflush(stdout);
+
+  for (;;)
+  {
+    host_sync();
+    host_line_reset();
+    host_flash_stats = (host_flash_counters){0};
+    host_boot_end = HAL_GetTick() + EMU_BOOT_WAIT;
+    int code = host_run(emu_session);
+    /* Only the sessions a host talked in. */
+    if (host_line_stats.rx_bytes)
+    {
+      host_report(emu_exit[code], host_flash_stats.written,
+                  host_line_stats.last_tx_ns - host_line_stats.first_rx_ns);
+      fflush(stdout);
+    }
+  }
+}
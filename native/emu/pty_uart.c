@@ -0,0 +1,310 @@
+/**
+ * @file    pty_uart.c
+ * @brief   uart.h over the master side of a pseudo-terminal, in real time.
+ *          A PTY has no line rate, the uploading tool writes as fast as it
+ *          can: a reader thread stamps every byte with the time it would
+ *          arrive at the current rate and the bootloader only gets it then.
+ *          Bytes that arrive while the bootloader is busy wait in the ring
+ *          (UART_RX_BUFFER_SIZE) like with the DMA, half duplex builds lose
+ *          what arrives while they send and for the turnaround after it.
+ */
+
+#define _GNU_SOURCE /* posix_openpt(), cfmakeraw() */
+
+#include "uart.h"
+#include "host.h"
+#include "pty_uart.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PTY_QUEUE 0x10000u
+
+uint32_t host_uart_turnaround_us;
+
+static int pty_fd = -1;
+static int pty_slave_fd = -1;
+static pthread_t pty_thread;
+static pthread_mutex_t pty_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pty_arrived;
+
+/* Written by the reader thread (head) and the bootloader (tail), under pty_lock. */
+static uint8_t pty_data[PTY_QUEUE];
+static uint64_t pty_time[PTY_QUEUE]; /**< Arrival of each byte, ns. */
+static uint8_t pty_lost[PTY_QUEUE];  /**< Arrived while sending. */
+static uint32_t pty_head, pty_tail;
+static uint64_t pty_last; /**< Arrival of the last queued byte. */
+static uint64_t pty_deaf_from, pty_deaf_until; /**< Receiver off (half duplex). */
+static uint32_t pty_rate;
+
+static uint64_t pty_byte_ns(void)
+{
+  return 10000000000ull / pty_rate;
+}
+
+static void *pty_reader(void *arg)
+{
+  uint8_t buffer[256];
+  struct pollfd fds = {.fd = pty_fd, .events = POLLIN};
+
+  (void)arg;
+  for (;;)
+  {
+    if (poll(&fds, 1, -1) < 0)
+    {
+      continue;
+    }
+    ssize_t length = read(pty_fd, buffer, sizeof(buffer));
+    if (length <= 0)
+    {
+      continue;
+    }
+    pthread_mutex_lock(&pty_lock);
+    uint64_t now = host_wall_time();
+    for (ssize_t i = 0; i < length; i++)
+    {
+      if ((pty_head - pty_tail) >= PTY_QUEUE)
+      {
+        host_line_stats.dropped++;
+        continue;
+      }
+      uint32_t slot = pty_head % PTY_QUEUE;
+      pty_last = ((pty_last > now) ? pty_last : now) + pty_byte_ns();
+      pty_data[slot] = buffer[i];
+      pty_time[slot] = pty_last;
+      pty_lost[slot] = (pty_deaf_from < pty_last) && (pty_last <= pty_deaf_until);
+      pty_head++;
+    }
+    pthread_cond_signal(&pty_arrived);
+    pthread_mutex_unlock(&pty_lock);
+  }
+  return NULL;
+}
+
+/* Sleeps (pty_lock held) until the virtual time target or new input. */
+static void pty_wait(uint64_t target)
+{
+  struct timespec until;
+  uint64_t now = host_wall_time();
+  uint64_t left = (target > now) ? (target - now) : 0u;
+
+  clock_gettime(CLOCK_MONOTONIC, &until);
+  left += (uint64_t)until.tv_nsec;
+  until.tv_sec += (time_t)(left / 1000000000u);
+  until.tv_nsec = (long)(left % 1000000000u);
+  pthread_cond_timedwait(&pty_arrived, &pty_lock, &until);
+  host_sync();
+}
+
+int pty_open(const char *link)
+{
+  pthread_condattr_t attr;
+  struct termios raw;
+
+  pty_fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if ((pty_fd < 0) || (0 != grantpt(pty_fd)) || (0 != unlockpt(pty_fd)))
+  {
+    perror("posix_openpt");
+    return -1;
+  }
+  /* Kept open: the master reads no hangup between two tool runs. Raw, so
+   * the line discipline passes every byte. */
+  pty_slave_fd = open(ptsname(pty_fd), O_RDWR | O_NOCTTY);
+  if ((pty_slave_fd < 0) || (0 != tcgetattr(pty_slave_fd, &raw)))
+  {
+    perror(ptsname(pty_fd));
+    return -1;
+  }
+  cfmakeraw(&raw);
+  tcsetattr(pty_slave_fd, TCSANOW, &raw);
+  /* Nobody listening must not block the bootloader, the line drops it. */
+  fcntl(pty_fd, F_SETFL, fcntl(pty_fd, F_GETFL) | O_NONBLOCK);
+  if (link)
+  {
+    unlink(link);
+    if (0 != symlink(ptsname(pty_fd), link))
+    {
+      perror(link);
+      return -1;
+    }
+  }
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&pty_arrived, &attr);
+  pthread_condattr_destroy(&attr);
+  return pthread_create(&pty_thread, NULL, pty_reader, NULL);
+}
+
+const char *pty_name(void)
+{
+  return ptsname(pty_fd);
+}
+
+void host_uart_reset(void)
+{
+  pthread_mutex_lock(&pty_lock);
+  host_uart_turnaround_us = 0u;
+  pty_tail = pty_head;
+  pty_last = 0u;
+  pty_deaf_from = pty_deaf_until = 0u;
+#ifdef UART_BAUD
+  pty_rate = UART_BAUD;
+#else
+  pty_rate = 420000u;
+#endif
+  pthread_mutex_unlock(&pty_lock);
+}
+
+/* Drops the bytes lost in a transmission and those that found the ring full. */
+static void pty_drop(void)
+{
+  uint32_t arrived = 0u;
+  while ((pty_tail != pty_head) && pty_lost[pty_tail % PTY_QUEUE])
+  {
+    pty_tail++;
+    host_line_stats.dropped++;
+  }
+  while (((pty_tail + arrived) != pty_head) &&
+         (pty_time[(pty_tail + arrived) % PTY_QUEUE] <= host_time_ns))
+  {
+    arrived++;
+  }
+  if (arrived > UART_RX_BUFFER_SIZE)
+  {
+    host_line_stats.dropped += arrived - UART_RX_BUFFER_SIZE;
+    pty_tail += arrived - UART_RX_BUFFER_SIZE;
+  }
+}
+
+uart_status uart_receive(uint8_t *data, uint16_t length)
+{
+  return uart_receive_timeout(data, length, UART_TIMEOUT);
+}
+
+uart_status uart_receive_timeout(uint8_t *data, uint16_t length, uint16_t timeout)
+{
+  uart_status status = UART_OK;
+
+  host_sync();
+  uint64_t deadline = host_time_ns + ((uint64_t)timeout * 1000000u);
+  pthread_mutex_lock(&pty_lock);
+  while (length)
+  {
+    pty_drop();
+    if ((pty_tail != pty_head) && (pty_time[pty_tail % PTY_QUEUE] <= host_time_ns))
+    {
+      host_line_rx(pty_time[pty_tail % PTY_QUEUE]);
+      *data++ = pty_data[pty_tail % PTY_QUEUE];
+      pty_tail++;
+      length--;
+    }
+    else if (host_time_ns >= deadline)
+    {
+      status = UART_ERROR;
+      break;
+    }
+    else if ((pty_tail != pty_head) && (pty_time[pty_tail % PTY_QUEUE] < deadline))
+    {
+      pty_wait(pty_time[pty_tail % PTY_QUEUE]);
+    }
+    else
+    {
+      pty_wait(deadline);
+    }
+  }
+  pthread_mutex_unlock(&pty_lock);
+  return status;
+}
+
+uart_status uart_transmit_str(uint8_t *data)
+{
+  return uart_transmit_bytes(data, (uint32_t)strlen((const char *)data));
+}
+
+uart_status uart_transmit_ch(uint8_t data)
+{
+  return uart_transmit_bytes(&data, 1u);
+}
+
+uart_status uart_transmit_bytes(uint8_t *data, uint32_t len)
+{
+  host_sync();
+  host_line_tx(len);
+#if HALF_DUPLEX
+  /* Whatever is on the line meanwhile collides with the transmission. */
+  pthread_mutex_lock(&pty_lock);
+  pty_deaf_from = host_time_ns;
+  pty_deaf_until = host_time_ns + (len * pty_byte_ns()) + ((uint64_t)host_uart_turnaround_us * 1000u);
+  for (uint32_t i = pty_tail; i != pty_head; i++)
+  {
+    uint64_t arrival = pty_time[i % PTY_QUEUE];
+    if ((pty_deaf_from < arrival) && (arrival <= pty_deaf_until))
+    {
+      pty_lost[i % PTY_QUEUE] = 1u;
+    }
+  }
+  pthread_mutex_unlock(&pty_lock);
+#endif
+  /* The tool sees the bytes once the last one is out. */
+  host_advance(len * pty_byte_ns());
+  host_line_stats.last_tx_ns = host_time_ns;
+  while (len)
+  {
+    ssize_t written = write(pty_fd, data, len);
+    if (written <= 0)
+    {
+      break;
+    }
+    data += written;
+    len -= (uint32_t)written;
+  }
+  return UART_OK;
+}
+
+uint32_t uart_baud_get(void)
+{
+  return pty_rate;
+}
+
+uart_status uart_baud_check(uint32_t baud)
+{
+  return ((9600u <= baud) && (baud <= 4000000u)) ? UART_OK : UART_ERROR;
+}
+
+uart_status uart_baud_set(uint32_t baud)
+{
+  if (UART_OK != uart_baud_check(baud))
+  {
+    return UART_ERROR;
+  }
+  pty_rate = baud;
+  return UART_OK;
+}
+
+void uart_flush(void)
+{
+  host_sync();
+  pthread_mutex_lock(&pty_lock);
+  while ((pty_tail != pty_head) && (pty_time[pty_tail % PTY_QUEUE] <= host_time_ns))
+  {
+    pty_tail++;
+  }
+  pthread_mutex_unlock(&pty_lock);
+}
+
+uint8_t uart_rx_break(void)
+{
+  return 0u;
+}
+
+void uart_init(void)
+{
+}
@@ -0,0 +1,16 @@
+/**
+ * @file    pty_uart.h
+ * @brief   Pseudo-terminal of the device emulator, see pty_uart.c.
+ */
+
+#ifndef PTY_UART_H_
+#define PTY_UART_H_
+
+/* Opens the PTY and starts its reader, link (if not NULL) becomes a symlink
+ * to the slave. Returns 0 on success. */
+int pty_open(const char *link);
+
+/* Slave device the uploading tool opens. */
+const char *pty_name(void);
+
+#endif /* PTY_UART_H_ */
@@ -0,0 +1,109 @@
+/**
+ * @file    host_hal.h
+ * @brief   Stand-in for the STM32 CMSIS/HAL headers of the host build.
+ *
+ *          Only what the bootloader modules use: the HAL flash driver (the
+ *          flash is a RAM array, see sim/host_flash.c), the tick and the
+ *          core registers touched before the jump to the application. The
+ *          stm32xxxx*.h names included by main.h and flash.h are generated
+ *          by CMake and forward here. The family comes from the usual define
+ *          (STM32F1, STM32L0xx, STM32L4xx or STM32F3xx).
+ */
+
+#ifndef HOST_HAL_H_
+#define HOST_HAL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define __IO volatile
+
+typedef enum
+{
+  HAL_OK = 0x00u,
+  HAL_ERROR = 0x01u,
+  HAL_BUSY = 0x02u,
+  HAL_TIMEOUT = 0x03u
+} HAL_StatusTypeDef;
+
+#define HAL_MAX_DELAY 0xFFFFFFFFu
+
+/* Flash of the simulated part, the smallest of each family in use. */
+#define FLASH_BASE ((uint32_t)0x08000000u)
+#if defined(STM32F1)
+#define FLASH_PAGE_SIZE 0x400u   /* R9MM: STM32F103CB */
+#define HOST_FLASH_SIZE 0x20000u
+#elif defined(STM32L0xx)
+#define FLASH_PAGE_SIZE 0x80u    /* RHF76-052: STM32L072, map limited to 64K */
+#define HOST_FLASH_SIZE 0x10000u
+#elif defined(STM32L4xx)
+#define FLASH_PAGE_SIZE 0x800u   /* R9MX: STM32L433CB */
+#define HOST_FLASH_SIZE 0x20000u
+#elif defined(STM32F3xx)
+#define FLASH_PAGE_SIZE 0x800u   /* GHOST ATTO: STM32F301K8 */
+#define HOST_FLASH_SIZE 0x10000u
+#else
+#error "Not supported CPU type!"
+#endif
+#define FLASH_BANK1_END (FLASH_BASE + HOST_FLASH_SIZE - 1u)
+#define FLASH_BANK_1 1u
+
+/* The bootloader image and where it ends (the linker symbols on target). */
+#ifndef BL_FLASH_START
+#define BL_FLASH_START FLASH_BASE
+#endif
+#ifndef BL_FLASH_IMAGE_END
+#define BL_FLASH_IMAGE_END (FLASH_BASE + 0x2000u)
+#endif
+
+/* Host memory is all RAM, the flash array included. */
+#define SRAM_BASE 0x00000000u
+
+/* All flash reads of the modules go through the simulator. */
+#define FLASH_PTR(address) host_flash_ptr(address)
+uintptr_t host_flash_ptr(uint32_t address);
+
+#define FLASH_TYPEERASE_PAGES 0x00u
+#define FLASH_TYPEPROGRAM_HALFWORD 0x01u
+#define FLASH_TYPEPROGRAM_WORD 0x02u
+#define FLASH_TYPEPROGRAM_DOUBLEWORD 0x03u
+
+typedef struct
+{
+  uint32_t TypeErase;
+  uint32_t Banks;
+  uint32_t PageAddress; /**< F1, F3, L0 */
+  uint32_t Page;        /**< L4 */
+  uint32_t NbPages;
+} FLASH_EraseInitTypeDef;
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *PageError);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data);
+HAL_StatusTypeDef HAL_FLASHEx_HalfPageProgram(uint32_t Address, uint32_t *pBuffer);
+
+/* Tick and delays run on the virtual clock of the simulation. */
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+HAL_StatusTypeDef HAL_DeInit(void);
+
+/* Core registers written before the jump. */
+typedef struct
+{
+  __IO uint32_t VTOR;
+} SCB_Type;
+extern SCB_Type host_scb;
+#define SCB (&host_scb)
+
+void NVIC_SystemReset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_HAL_H_ */
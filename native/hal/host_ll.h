@@ -0,0 +1,177 @@
+/**
+ * @file    host_ll.h
+ * @brief   Stand-in for the LL GPIO and USART headers and the registers of
+ *          the USART, its RX DMA channel and the GPIO ports, for Src/uart.c
+ *          (USART_USE_LL, GPIO_USE_LL, DMA ring). The model behind them is
+ *          sim/host_usart.c.
+ *
+ *          CNDTR is read through the model: the DMA moves the bytes that
+ *          arrived by now into the ring before the count is returned. The
+ *          LL USART functions are functions of the model, the flags are
+ *          always up to date. Pins are bit masks on every family.
+ */
+
+#ifndef HOST_LL_H_
+#define HOST_LL_H_
+
+#include "host_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Clocks of SystemClock_Config(): PCLK1 and PCLK2 are SYSCLK / 2. */
+#if defined(STM32L0xx)
+#define HOST_PCLK 16000000u
+#elif defined(STM32L4xx)
+#define HOST_PCLK 40000000u
+#else /* F1, F3 */
+#define HOST_PCLK 32000000u
+#endif
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+uint32_t HAL_RCC_GetPCLK2Freq(void);
+
+/* USART */
+typedef struct
+{
+  __IO uint32_t CR1;
+  __IO uint32_t CR2;
+  __IO uint32_t CR3;
+  __IO uint32_t BRR;
+  __IO uint32_t DR;  /**< F1 */
+  __IO uint32_t RDR; /**< F3, L0, L4 */
+  __IO uint32_t TDR;
+} USART_TypeDef;
+
+extern USART_TypeDef host_usart[3];
+#define USART1 (&host_usart[0])
+#define USART2 (&host_usart[1])
+#if !defined(STM32L0xx)
+#define USART3 (&host_usart[2])
+#endif
+
+#define USART_CR1_UE 0x0001u /* the F3/L0/L4 positions, the model is the same */
+#define USART_CR1_RE 0x0004u
+#define USART_CR1_TE 0x0008u
+#if !defined(STM32F1)
+#define USART_CR1_OVER8 0x8000u
+#endif
+#define USART_CR3_HDSEL 0x0008u
+#define USART_CR3_DMAR 0x0040u
+
+void LL_USART_ConfigAsyncMode(USART_TypeDef *USARTx);
+void LL_USART_EnableHalfDuplex(USART_TypeDef *USARTx);
+void LL_USART_EnableDMAReq_RX(USART_TypeDef *USARTx);
+uint32_t LL_USART_IsActiveFlag_ORE(USART_TypeDef *USARTx);
+void LL_USART_ClearFlag_ORE(USART_TypeDef *USARTx);
+uint32_t LL_USART_IsActiveFlag_RXNE(USART_TypeDef *USARTx);
+uint8_t LL_USART_ReceiveData8(USART_TypeDef *USARTx);
+void LL_USART_TransmitData8(USART_TypeDef *USARTx, uint8_t Value);
+uint32_t LL_USART_IsActiveFlag_TXE(USART_TypeDef *USARTx);
+uint32_t LL_USART_IsActiveFlag_TC(USART_TypeDef *USARTx);
+
+#define __HAL_RCC_USART1_FORCE_RESET() ((void)0)
+#define __HAL_RCC_USART1_RELEASE_RESET() ((void)0)
+#define __HAL_RCC_USART1_CLK_ENABLE() ((void)0)
+#define __HAL_RCC_USART2_FORCE_RESET() ((void)0)
+#define __HAL_RCC_USART2_RELEASE_RESET() ((void)0)
+#define __HAL_RCC_USART2_CLK_ENABLE() ((void)0)
+#define __HAL_RCC_USART3_FORCE_RESET() ((void)0)
+#define __HAL_RCC_USART3_RELEASE_RESET() ((void)0)
+#define __HAL_RCC_USART3_CLK_ENABLE() ((void)0)
+
+/* DMA1. count[] is CNDTR, the index runs the model first. */
+typedef struct
+{
+  __IO uint32_t CCR;
+  __IO uint32_t count[1];
+  __IO uint32_t CPAR;
+  __IO uint32_t CMAR;
+} DMA_Channel_TypeDef;
+
+uint32_t host_dma_run(void);
+#define CNDTR count[host_dma_run()]
+
+extern DMA_Channel_TypeDef host_dma[7];
+#define DMA1_Channel3 (&host_dma[2])
+#define DMA1_Channel5 (&host_dma[4])
+#define DMA1_Channel6 (&host_dma[5])
+#if defined(STM32L0xx) || defined(STM32L4xx)
+typedef struct
+{
+  __IO uint32_t CSELR;
+} DMA_Request_TypeDef;
+extern DMA_Request_TypeDef host_dma_cselr;
+#define DMA1_CSELR (&host_dma_cselr)
+#endif
+
+#define DMA_CCR_EN 0x0001u
+#define DMA_CCR_CIRC 0x0020u
+#define DMA_CCR_MINC 0x0080u
+#define DMA_CCR_PSIZE 0x0300u
+#define DMA_CCR_MSIZE 0x0C00u
+#define DMA_CCR_PL_1 0x2000u
+
+#define __HAL_RCC_DMA1_CLK_ENABLE() ((void)0)
+#define MODIFY_REG(REG, CLEARMASK, SETMASK) ((REG) = (((REG) & ~(CLEARMASK)) | (SETMASK)))
+
+/* GPIO: the RX pin reads high, an idle line. */
+typedef struct
+{
+  __IO uint32_t MODER;
+  __IO uint32_t PUPDR;
+  __IO uint32_t IDR;
+} GPIO_TypeDef;
+
+extern GPIO_TypeDef host_gpio[3];
+#define GPIOA (&host_gpio[0])
+#define GPIOB (&host_gpio[1])
+#define GPIOC (&host_gpio[2])
+
+#define GPIO_PIN_2 0x0004u
+#define GPIO_PIN_3 0x0008u
+#define GPIO_PIN_4 0x0010u
+#define GPIO_PIN_5 0x0020u
+#define GPIO_PIN_6 0x0040u
+#define GPIO_PIN_7 0x0080u
+#define GPIO_PIN_8 0x0100u
+#define GPIO_PIN_9 0x0200u
+#define GPIO_PIN_10 0x0400u
+#define GPIO_PIN_11 0x0800u
+#define GPIO_PIN_14 0x4000u
+#define GPIO_PIN_15 0x8000u
+#define LL_GPIO_PIN_2 GPIO_PIN_2
+#define LL_GPIO_PIN_3 GPIO_PIN_3
+#define LL_GPIO_PIN_4 GPIO_PIN_4
+#define LL_GPIO_PIN_5 GPIO_PIN_5
+#define LL_GPIO_PIN_6 GPIO_PIN_6
+#define LL_GPIO_PIN_7 GPIO_PIN_7
+#define LL_GPIO_PIN_8 GPIO_PIN_8
+#define LL_GPIO_PIN_9 GPIO_PIN_9
+#define LL_GPIO_PIN_10 GPIO_PIN_10
+#define LL_GPIO_PIN_11 GPIO_PIN_11
+#define LL_GPIO_PIN_14 GPIO_PIN_14
+#define LL_GPIO_PIN_15 GPIO_PIN_15
+
+#define LL_GPIO_MODE_INPUT 0u
+#define LL_GPIO_MODE_OUTPUT 1u
+#define LL_GPIO_MODE_ALTERNATE 2u
+#define LL_GPIO_SPEED_FREQ_HIGH 2u
+#define LL_GPIO_PULL_UP 1u
+#define LL_GPIO_PULL_DOWN 2u
+#define LL_GPIO_AF_0 0u
+#define LL_GPIO_AF_4 4u
+#define LL_GPIO_AF_7 7u
+
+void LL_GPIO_SetPinMode(GPIO_TypeDef *GPIOx, uint32_t Pin, uint32_t Mode);
+void LL_GPIO_SetPinSpeed(GPIO_TypeDef *GPIOx, uint32_t Pin, uint32_t Speed);
+void LL_GPIO_SetPinPull(GPIO_TypeDef *GPIOx, uint32_t Pin, uint32_t Pull);
+void LL_GPIO_SetAFPin_0_7(GPIO_TypeDef *GPIOx, uint32_t Pin, uint32_t Alternate);
+void LL_GPIO_SetAFPin_8_15(GPIO_TypeDef *GPIOx, uint32_t Pin, uint32_t Alternate);
+uint32_t LL_GPIO_IsInputPinSet(GPIO_TypeDef *GPIOx, uint32_t PinMask);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_LL_H_ */
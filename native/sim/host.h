@@ -0,0 +1,115 @@
+/**
+ * @file    host.h
+ * @brief   Controls of the host simulation: virtual clock, flash array and
+ *          the UART peer that plays the uploading host.
+ *
+ *          Time only moves on the UART (10 bits per byte at the current
+ *          rate), the flash (typical datasheet times of the family) and
+ *          HAL_Delay(). The CPU time of the bootloader itself is not counted.
+ *          In real time mode (the PTY emulator) these waits are slept and
+ *          the clock follows the wall clock.
+ */
+
+#ifndef HOST_H_
+#define HOST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* How the bootloader was left (host_run()). */
+enum host_exit
+{
+  HOST_EXIT_RETURN = 1, /**< The entry function returned. */
+  HOST_EXIT_START,      /**< Jumped to the application (HAL_DeInit()). */
+  HOST_EXIT_RESET,      /**< NVIC_SystemReset(). */
+  HOST_EXIT_IDLE        /**< Waited on the UART longer than host_uart_idle_limit. */
+};
+
+/* Virtual time since host_reset(), in ns. */
+extern uint64_t host_time_ns;
+extern uint8_t host_realtime;
+extern uint32_t host_tick_reads; /**< HAL_GetTick() calls, a CPU waiting on something. */
+
+void host_advance(uint64_t ns);
+void host_sync(void);
+uint64_t host_wall_time(void); /**< Wall clock since host_reset(), ns. */
+
+/* Deadline of timer_end() in ms, the boot wait of main.c. */
+extern uint32_t host_boot_end;
+
+void host_reset(void);
+int host_run(void (*entry)(void));
+
+/* Flash: erased on host_reset(). */
+uint8_t *host_flash_mem(uint32_t address);
+void host_flash_erase_all(void);
+
+/* Erasing the page at this address fails (a worn out or protected page),
+ * 0: none. Cleared on host_reset(). */
+extern uint32_t host_flash_bad_page;
+
+typedef struct
+{
+  uint32_t erases;   /**< Pages erased. */
+  uint32_t programs; /**< Program operations (of any width). */
+  uint32_t written;  /**< Bytes programmed. */
+  uint64_t busy_ns;  /**< Time spent erasing and programming. */
+} host_flash_counters;
+
+extern host_flash_counters host_flash_stats;
+
+/* Line statistics, kept by the UART backends. The reply latency is the time
+ * from the last byte taken to the start of the next transmission. */
+typedef struct
+{
+  uint32_t rx_bytes;       /**< Bytes taken by the bootloader. */
+  uint32_t tx_bytes;       /**< Bytes sent. */
+  uint32_t dropped;        /**< Lost to a full ring or a half duplex collision. */
+  uint32_t replies;        /**< Transmissions after received bytes. */
+  uint64_t first_rx_ns;    /**< Arrival of the first byte taken. */
+  uint64_t last_tx_ns;     /**< End of the last transmission. */
+  uint64_t latency_ns;     /**< Sum of the reply latencies. */
+  uint64_t latency_max_ns; /**< Longest reply latency. */
+} host_line_counters;
+
+extern host_line_counters host_line_stats;
+
+void host_line_reset(void);
+void host_line_rx(uint64_t arrival_ns);
+void host_line_tx(uint32_t length);
+
+/* One line of throughput and latency figures for a session of session_ns
+ * that uploaded size bytes, tagged with the target (HOST_ENV) and protocol. */
+void host_report(const char *label, uint32_t size, uint64_t session_ns);
+
+/* Half duplex line (HALF_DUPLEX builds): the receiver is off while sending and
+ * for the turnaround time after it, bytes arriving then are lost. */
+extern uint32_t host_uart_turnaround_us;
+
+/* UART: the peer is called with every chunk the bootloader transmits, at the
+ * time the last byte is out, and answers with host_uart_feed(). */
+extern void (*host_uart_peer)(const uint8_t *data, uint32_t length);
+extern uint32_t host_uart_idle_limit; /**< ms without input until HOST_EXIT_IDLE. */
+extern FILE *host_uart_record; /**< Gets a copy of the input if set (fuzz seeds). */
+
+void host_uart_reset(void);
+void host_uart_feed(const uint8_t *data, uint32_t length);
+void host_uart_feed_after(uint32_t delay_us, const uint8_t *data, uint32_t length);
+uint32_t host_uart_pending(void);
+
+/* The line end of the UART backends: sim/host_uart.c implements uart.h on
+ * it, sim/host_usart.c the registers the real Src/uart.c drives (benches). */
+uint8_t host_uart_arrive(uint8_t *data);  /**< Takes a byte that has arrived by now. */
+void host_uart_wait(void);                /**< Clock to the next arrival or ms tick. */
+void host_uart_send(const uint8_t *data, uint32_t length);
+void host_uart_rate_set(uint32_t rate);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_H_ */
@@ -0,0 +1,200 @@
+/**
+ * @file    host_board.c
+ * @brief   Board functions of main.c and the HAL tick on the virtual clock.
+ *          Leaving the bootloader (jump or reset) returns to host_run().
+ */
+
+#include "main.h"
+#include "mailbox.h"
+#include "uart.h"
+#include "host.h"
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+uint64_t host_time_ns;
+uint8_t host_realtime;
+uint32_t host_tick_reads;
+uint32_t host_boot_end;
+host_line_counters host_line_stats;
+jmp_buf host_exit_point;
+SCB_Type host_scb;
+boot_mailbox _boot_mailbox;
+
+static uint64_t host_epoch_ns; /**< Wall clock at host_reset(). */
+static uint64_t host_rx_last_ns; /**< Arrival of the last byte taken. */
+static uint8_t host_rx_unanswered; /**< Bytes were taken since the last reply. */
+
+static uint64_t host_wall_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t)now.tv_sec * 1000000000u) + (uint64_t)now.tv_nsec;
+}
+
+uint64_t host_wall_time(void)
+{
+  return host_wall_ns() - host_epoch_ns;
+}
+
+/* Time passes while the bootloader waits, the wall clock has to keep up. */
+void host_advance(uint64_t ns)
+{
+  host_time_ns += ns;
+  if (host_realtime)
+  {
+    uint64_t wall = host_wall_time();
+    if (host_time_ns > wall)
+    {
+      uint64_t left = host_time_ns - wall;
+      struct timespec sleep = {(time_t)(left / 1000000000u), (long)(left % 1000000000u)};
+      nanosleep(&sleep, NULL);
+    }
+  }
+}
+
+/* The wall clock went on while the bootloader was running. */
+void host_sync(void)
+{
+  if (host_realtime)
+  {
+    uint64_t wall = host_wall_time();
+    if (wall > host_time_ns)
+    {
+      host_time_ns = wall;
+    }
+  }
+}
+
+void host_line_reset(void)
+{
+  host_line_stats = (host_line_counters){0};
+  host_rx_unanswered = 0u;
+}
+
+void host_line_rx(uint64_t arrival_ns)
+{
+  if (0u == host_line_stats.rx_bytes)
+  {
+    host_line_stats.first_rx_ns = arrival_ns;
+  }
+  host_line_stats.rx_bytes++;
+  host_rx_last_ns = arrival_ns;
+  host_rx_unanswered = 1u;
+}
+
+void host_line_tx(uint32_t length)
+{
+  if (host_rx_unanswered)
+  {
+    uint64_t latency = host_time_ns - host_rx_last_ns;
+    host_line_stats.replies++;
+    host_line_stats.latency_ns += latency;
+    if (host_line_stats.latency_max_ns < latency)
+    {
+      host_line_stats.latency_max_ns = latency;
+    }
+    host_rx_unanswered = 0u;
+  }
+  host_line_stats.tx_bytes += length;
+}
+
+#if STK500
+#define HOST_PROTOCOL "stk500"
+#elif FRSKY
+#define HOST_PROTOCOL "frsky"
+#else
+#define HOST_PROTOCOL "xmodem"
+#endif
+#ifndef HOST_ENV
+#define HOST_ENV "host"
+#endif
+
+void host_report(const char *label, uint32_t size, uint64_t session_ns)
+{
+  double seconds = (double)session_ns / 1e9;
+  double line = (double)host_line_stats.rx_bytes * 10.0 / (double)uart_baud_get();
+  double latency = host_line_stats.replies ?
+                   ((double)host_line_stats.latency_ns / (double)host_line_stats.replies) : 0.0;
+
+  printf("%-24s %-6s %-12s %6u B %8.3f s %6.2f KiB/s  line %3.0f%%  flash %7.3f s %4u erases"
+         "  latency %6.3f/%6.3f ms  %u dropped\n",
+         HOST_ENV, HOST_PROTOCOL, label, (unsigned)size, seconds,
+         (seconds > 0.0) ? ((double)size / 1024.0 / seconds) : 0.0,
+         (seconds > 0.0) ? (100.0 * line / seconds) : 0.0,
+         (double)host_flash_stats.busy_ns / 1e9, (unsigned)host_flash_stats.erases,
+         latency / 1e6, (double)host_line_stats.latency_max_ns / 1e6,
+         (unsigned)host_line_stats.dropped);
+}
+
+void host_reset(void)
+{
+  host_epoch_ns = host_wall_ns();
+  host_time_ns = 0u;
+  host_boot_end = 0xFFFFFFFFu;
+  host_scb.VTOR = 0u;
+  _boot_mailbox = (boot_mailbox){0};
+  host_flash_erase_all();
+  host_line_reset();
+  host_uart_reset();
+}
+
+int host_run(void (*entry)(void))
+{
+  int code = setjmp(host_exit_point);
+  if (0 == code)
+  {
+    entry();
+    code = HOST_EXIT_RETURN;
+  }
+  return code;
+}
+
+uint32_t HAL_GetTick(void)
+{
+  host_sync();
+  host_tick_reads++;
+  return (uint32_t)(host_time_ns / 1000000u);
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+  host_advance((uint64_t)Delay * 1000000u);
+}
+
+HAL_StatusTypeDef HAL_DeInit(void)
+{
+  longjmp(host_exit_point, HOST_EXIT_START);
+}
+
+void NVIC_SystemReset(void)
+{
+  longjmp(host_exit_point, HOST_EXIT_RESET);
+}
+
+void Error_Handler(void)
+{
+  fprintf(stderr, "Error_Handler()\n");
+  abort();
+}
+
+void led_state_set(uint32_t state)
+{
+  (void)state;
+}
+
+void duplex_state_set(const enum duplex_state state)
+{
+  (void)state;
+}
+
+int8_t timer_end(void)
+{
+  return (HAL_GetTick() >= host_boot_end) ? 1 : 0;
+}
+
+uint32_t stack_peak(void)
+{
+  return 0u;
+}
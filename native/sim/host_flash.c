@@ -0,0 +1,167 @@
+/**
+ * @file    host_flash.c
+ * @brief   HAL flash driver over a RAM array. Programming a location that is
+ *          not erased fails like on the parts, every operation takes the
+ *          typical time of the family from its datasheet.
+ */
+
+#include "host.h"
+#include "host_hal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(STM32L0xx)
+#define HOST_FLASH_ERASED 0x00u
+#define HOST_ERASE_US 3200u      /* page erase */
+#define HOST_PROGRAM_US 3200u    /* word or half page */
+#elif defined(STM32L4xx)
+#define HOST_FLASH_ERASED 0xFFu
+#define HOST_ERASE_US 22000u     /* page erase */
+#define HOST_PROGRAM_US 82u      /* double word */
+#else /* F1, F3 */
+#define HOST_FLASH_ERASED 0xFFu
+#define HOST_ERASE_US 20000u     /* page erase */
+#define HOST_PROGRAM_US 53u      /* half word */
+#endif
+
+host_flash_counters host_flash_stats;
+uint32_t host_flash_bad_page;
+
+static uint8_t host_flash[HOST_FLASH_SIZE];
+static uint8_t host_flash_unlocked;
+
+uintptr_t host_flash_ptr(uint32_t address)
+{
+  return (uintptr_t)host_flash_mem(address);
+}
+
+uint8_t *host_flash_mem(uint32_t address)
+{
+  if ((address < FLASH_BASE) || (address > FLASH_BANK1_END))
+  {
+    fprintf(stderr, "flash access out of range: 0x%08X\n", (unsigned)address);
+    abort();
+  }
+  return &host_flash[address - FLASH_BASE];
+}
+
+void host_flash_erase_all(void)
+{
+  memset(host_flash, HOST_FLASH_ERASED, sizeof(host_flash));
+  memset(&host_flash_stats, 0, sizeof(host_flash_stats));
+  host_flash_unlocked = 0u;
+  host_flash_bad_page = 0u;
+}
+
+static void host_flash_busy(uint32_t us)
+{
+  host_advance((uint64_t)us * 1000u);
+  host_flash_stats.busy_ns += (uint64_t)us * 1000u;
+}
+
+/* Writes size bytes if the target is erased and in range. */
+static HAL_StatusTypeDef host_flash_write(uint32_t address, const void *data, uint32_t size)
+{
+  if (!host_flash_unlocked || (address % size) || (address < FLASH_BASE) ||
+      ((address + size - 1u) > FLASH_BANK1_END))
+  {
+    return HAL_ERROR;
+  }
+  uint8_t *mem = host_flash_mem(address);
+  for (uint32_t i = 0u; i < size; i++)
+  {
+    if (HOST_FLASH_ERASED != mem[i])
+    {
+      return HAL_ERROR;
+    }
+  }
+  memcpy(mem, data, size);
+  host_flash_stats.programs++;
+  host_flash_stats.written += size;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+  host_flash_unlocked = 1u;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+  host_flash_unlocked = 0u;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *PageError)
+{
+#if defined(STM32L4xx)
+  uint32_t address = FLASH_BASE + (pEraseInit->Page * FLASH_PAGE_SIZE);
+#else
+  uint32_t address = pEraseInit->PageAddress;
+#endif
+  *PageError = 0xFFFFFFFFu;
+  for (uint32_t i = 0u; i < pEraseInit->NbPages; i++, address += FLASH_PAGE_SIZE)
+  {
+    if (!host_flash_unlocked || (FLASH_TYPEERASE_PAGES != pEraseInit->TypeErase) ||
+        (address % FLASH_PAGE_SIZE) || (address < FLASH_BASE) || (address > FLASH_BANK1_END) ||
+        (address == host_flash_bad_page))
+    {
+      *PageError = address;
+      return HAL_ERROR;
+    }
+    memset(host_flash_mem(address), HOST_FLASH_ERASED, FLASH_PAGE_SIZE);
+    host_flash_stats.erases++;
+    host_flash_busy(HOST_ERASE_US);
+  }
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data)
+{
+  HAL_StatusTypeDef status;
+  uint16_t halfword = (uint16_t)Data;
+  uint32_t word = (uint32_t)Data;
+
+  switch (TypeProgram)
+  {
+  case FLASH_TYPEPROGRAM_HALFWORD:
+    status = host_flash_write(Address, &halfword, 2u);
+    host_flash_busy(HOST_PROGRAM_US);
+    break;
+#if !defined(STM32L4xx)
+  case FLASH_TYPEPROGRAM_WORD:
+    status = host_flash_write(Address, &word, 4u);
+#if defined(STM32L0xx)
+    host_flash_busy(HOST_PROGRAM_US);
+#else
+    host_flash_busy(2u * HOST_PROGRAM_US);
+#endif
+    break;
+#else
+  case FLASH_TYPEPROGRAM_DOUBLEWORD:
+    status = host_flash_write(Address, &Data, 8u);
+    host_flash_busy(HOST_PROGRAM_US);
+    break;
+#endif
+  default:
+    (void)word;
+    status = HAL_ERROR;
+    break;
+  }
+  return status;
+}
+
+#if defined(STM32L0xx)
+HAL_StatusTypeDef HAL_FLASHEx_HalfPageProgram(uint32_t Address, uint32_t *pBuffer)
+{
+  HAL_StatusTypeDef status = HAL_ERROR;
+  if (0u == (Address % (FLASH_PAGE_SIZE / 2u)))
+  {
+    status = host_flash_write(Address, pBuffer, FLASH_PAGE_SIZE / 2u);
+  }
+  host_flash_busy(HOST_PROGRAM_US);
+  return status;
+}
+#endif
@@ -0,0 +1,277 @@
+/**
+ * @file    host_uart.c
+ * @brief   uart.h over a queue of timed bytes. The peer (the uploading host)
+ *          sees every transmission and queues its answer, a byte arrives 10
+ *          bit times after the previous one. Bytes that arrive while the
+ *          bootloader is busy wait in the receive ring like with the DMA.
+ *
+ *          With HOST_USART the uart.h part is left out, the real Src/uart.c
+ *          runs on the register model of sim/host_usart.c, which takes the
+ *          bytes from the same queue.
+ */
+
+#include "uart.h"
+#include "host.h"
+#include "host_hal.h"
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+
+#define HOST_UART_QUEUE 0x10000u
+
+void (*host_uart_peer)(const uint8_t *data, uint32_t length);
+FILE *host_uart_record;
+uint32_t host_uart_idle_limit;
+uint32_t host_uart_turnaround_us;
+
+extern jmp_buf host_exit_point;
+
+static uint8_t host_uart_data[HOST_UART_QUEUE];
+static uint64_t host_uart_time[HOST_UART_QUEUE]; /**< Arrival of each byte, ns. */
+static uint8_t host_uart_lost[HOST_UART_QUEUE];  /**< Arrived while sending. */
+static uint32_t host_uart_head, host_uart_tail;
+static uint64_t host_uart_last; /**< Arrival of the last queued byte. */
+static uint64_t host_uart_deaf_from, host_uart_deaf_until; /**< Receiver off (half duplex). */
+static uint32_t host_uart_idle; /**< ms waited on an empty queue. */
+static uint32_t host_uart_rate;
+
+static uint64_t host_uart_byte_ns(void)
+{
+  return 10000000000ull / host_uart_rate;
+}
+
+void host_uart_reset(void)
+{
+  host_uart_peer = NULL;
+  host_uart_idle_limit = 5000u;
+  host_uart_turnaround_us = 0u;
+  host_uart_head = host_uart_tail = 0u;
+  host_uart_last = 0u;
+  host_uart_deaf_from = host_uart_deaf_until = 0u;
+  host_uart_idle = 0u;
+#ifdef UART_BAUD
+  host_uart_rate = UART_BAUD;
+#else
+  host_uart_rate = 420000u;
+#endif
+}
+
+void host_uart_feed_after(uint32_t delay_us, const uint8_t *data, uint32_t length)
+{
+  uint64_t start = host_time_ns + ((uint64_t)delay_us * 1000u);
+  if (host_uart_last > start)
+  {
+    start = host_uart_last;
+  }
+  if (host_uart_record)
+  {
+    fwrite(data, 1u, length, host_uart_record);
+  }
+  while (length--)
+  {
+    uint32_t slot = host_uart_head % HOST_UART_QUEUE;
+    start += host_uart_byte_ns();
+    host_uart_data[slot] = *data++;
+    host_uart_time[slot] = start;
+    host_uart_lost[slot] = (host_uart_deaf_from < start) && (start <= host_uart_deaf_until);
+    host_uart_head++;
+  }
+  host_uart_last = start;
+}
+
+void host_uart_feed(const uint8_t *data, uint32_t length)
+{
+  host_uart_feed_after(0u, data, length);
+}
+
+uint32_t host_uart_pending(void)
+{
+  return host_uart_head - host_uart_tail;
+}
+
+void host_uart_rate_set(uint32_t rate)
+{
+  host_uart_rate = rate;
+}
+
+/* Skips the bytes lost in a transmission. */
+static void host_uart_skip_lost(void)
+{
+  while ((host_uart_tail != host_uart_head) && host_uart_lost[host_uart_tail % HOST_UART_QUEUE])
+  {
+    host_uart_tail++;
+    host_line_stats.dropped++;
+  }
+}
+
+uint8_t host_uart_arrive(uint8_t *data)
+{
+  host_uart_skip_lost();
+  if ((host_uart_tail == host_uart_head) ||
+      (host_uart_time[host_uart_tail % HOST_UART_QUEUE] > host_time_ns))
+  {
+    return 0u;
+  }
+  *data = host_uart_data[host_uart_tail % HOST_UART_QUEUE];
+  host_line_rx(host_uart_time[host_uart_tail % HOST_UART_QUEUE]);
+  host_uart_tail++;
+  host_uart_idle = 0u;
+  return 1u;
+}
+
+void host_uart_wait(void)
+{
+  uint64_t tick = ((host_time_ns / 1000000u) + 1u) * 1000000u;
+
+  host_uart_skip_lost();
+  if (host_uart_tail != host_uart_head)
+  {
+    uint64_t arrival = host_uart_time[host_uart_tail % HOST_UART_QUEUE];
+    host_time_ns = (arrival < tick) ? arrival : tick;
+    return;
+  }
+  if (++host_uart_idle > host_uart_idle_limit)
+  {
+    longjmp(host_exit_point, HOST_EXIT_IDLE);
+  }
+  host_time_ns = tick;
+}
+
+void host_uart_send(const uint8_t *data, uint32_t length)
+{
+  host_line_tx(length);
+#if HALF_DUPLEX
+  /* Whatever is on the line meanwhile collides with the transmission. */
+  host_uart_deaf_from = host_time_ns;
+  host_uart_deaf_until = host_time_ns + (length * host_uart_byte_ns()) + ((uint64_t)host_uart_turnaround_us * 1000u);
+  for (uint32_t i = host_uart_tail; i != host_uart_head; i++)
+  {
+    uint64_t arrival = host_uart_time[i % HOST_UART_QUEUE];
+    if ((host_uart_deaf_from < arrival) && (arrival <= host_uart_deaf_until))
+    {
+      host_uart_lost[i % HOST_UART_QUEUE] = 1u;
+    }
+  }
+#endif
+  host_time_ns += length * host_uart_byte_ns();
+  host_line_stats.last_tx_ns = host_time_ns;
+  if (host_uart_peer)
+  {
+    host_uart_peer(data, length);
+  }
+}
+
+#if !HOST_USART
+
+/* Drops the bytes lost in a transmission and those that found the ring full. */
+static void host_uart_drop(void)
+{
+  uint32_t arrived = 0u;
+  host_uart_skip_lost();
+  while (((host_uart_tail + arrived) != host_uart_head) &&
+         (host_uart_time[(host_uart_tail + arrived) % HOST_UART_QUEUE] <= host_time_ns))
+  {
+    arrived++;
+  }
+  if (arrived > UART_RX_BUFFER_SIZE)
+  {
+    host_line_stats.dropped += arrived - UART_RX_BUFFER_SIZE;
+    host_uart_tail += arrived - UART_RX_BUFFER_SIZE;
+  }
+}
+
+uart_status uart_receive(uint8_t *data, uint16_t length)
+{
+  return uart_receive_timeout(data, length, UART_TIMEOUT);
+}
+
+uart_status uart_receive_timeout(uint8_t *data, uint16_t length, uint16_t timeout)
+{
+  uint64_t deadline = host_time_ns + ((uint64_t)timeout * 1000000u);
+
+  while (length--)
+  {
+    host_uart_drop();
+    if (host_uart_tail == host_uart_head)
+    {
+      host_uart_idle += (uint32_t)((deadline - host_time_ns) / 1000000u);
+      host_time_ns = deadline;
+      if (host_uart_idle > host_uart_idle_limit)
+      {
+        longjmp(host_exit_point, HOST_EXIT_IDLE);
+      }
+      return UART_ERROR;
+    }
+    uint64_t arrival = host_uart_time[host_uart_tail % HOST_UART_QUEUE];
+    if (arrival > deadline)
+    {
+      host_time_ns = deadline;
+      return UART_ERROR;
+    }
+    if (arrival > host_time_ns)
+    {
+      host_time_ns = arrival;
+    }
+    *data++ = host_uart_data[host_uart_tail % HOST_UART_QUEUE];
+    host_uart_tail++;
+    host_uart_idle = 0u;
+    host_line_rx(arrival);
+  }
+  return UART_OK;
+}
+
+uart_status uart_transmit_str(uint8_t *data)
+{
+  return uart_transmit_bytes(data, (uint32_t)strlen((const char *)data));
+}
+
+uart_status uart_transmit_ch(uint8_t data)
+{
+  return uart_transmit_bytes(&data, 1u);
+}
+
+uart_status uart_transmit_bytes(uint8_t *data, uint32_t len)
+{
+  host_uart_send(data, len);
+  return UART_OK;
+}
+
+uint32_t uart_baud_get(void)
+{
+  return host_uart_rate;
+}
+
+uart_status uart_baud_check(uint32_t baud)
+{
+  return ((9600u <= baud) && (baud <= 4000000u)) ? UART_OK : UART_ERROR;
+}
+
+uart_status uart_baud_set(uint32_t baud)
+{
+  if (UART_OK != uart_baud_check(baud))
+  {
+    return UART_ERROR;
+  }
+  host_uart_rate = baud;
+  return UART_OK;
+}
+
+void uart_flush(void)
+{
+  while ((host_uart_tail != host_uart_head) &&
+         (host_uart_time[host_uart_tail % HOST_UART_QUEUE] <= host_time_ns))
+  {
+    host_uart_tail++;
+  }
+}
+
+uint8_t uart_rx_break(void)
+{
+  return 0u;
+}
+
+void uart_init(void)
+{
+}
+
+#endif /* !HOST_USART */
@@ -0,0 +1,265 @@
+/**
+ * @file    host_usart.c
+ * @brief   Register model of the USART, its RX DMA channel and the GPIO for
+ *          the real Src/uart.c (see hal/host_ll.h). The bytes come from the
+ *          line of sim/host_uart.c (built with HOST_USART).
+ *
+ *          The DMA channel writes every byte into the ring at its arrival
+ *          and counts CNDTR down, circular, whether or not the CPU has read
+ *          the ring: an overrun overwrites like on the part. Reading the
+ *          same CNDTR again at the same time, with a look at the tick in
+ *          between, is the CPU polling (the timeout loop of uart.c): the
+ *          clock moves to the next arrival or ms tick. Without the tick the
+ *          CPU is taking bytes already in the ring. Transmitted bytes go to
+ *          the peer at TC. The line rate follows BRR.
+ *
+ *          The ring address goes through the 32 bit CMAR: the benches are
+ *          linked without PIE, so that the static ring is below 4 GiB.
+ */
+
+#include "main.h"
+#include "uart.h"
+#include "host.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+USART_TypeDef host_usart[3];
+DMA_Channel_TypeDef host_dma[7];
+#if defined(STM32L0xx) || defined(STM32L4xx)
+DMA_Request_TypeDef host_dma_cselr;
+#endif
+GPIO_TypeDef host_gpio[3];
+
+static uint8_t host_usart_tx[256]; /**< Bytes written since the last TC. */
+static uint32_t host_usart_tx_size;
+static uint32_t host_dma_reload;   /**< CNDTR when the channel was enabled. */
+static uint8_t host_dma_enabled;
+static uint64_t host_dma_read_ns;  /**< Time of the last CNDTR read. */
+static uint32_t host_dma_read;     /**< CNDTR then. */
+static uint32_t host_dma_ticks;    /**< host_tick_reads then. */
+
+static void host_usart_fail(const char *what)
+{
+  fprintf(stderr, "USART model: %s\n", what);
+  abort();
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void)
+{
+  return HOST_PCLK;
+}
+
+uint32_t HAL_RCC_GetPCLK2Freq(void)
+{
+  return HOST_PCLK;
+}
+
+void gpio_port_clock(uint32_t port)
+{
+  (void)port;
+}
+
+/* Line rate of the BRR setting, 8x oversampling with OVER8. */
+static void host_usart_rate(const USART_TypeDef *USARTx)
+{
+  uint32_t div = USARTx->BRR;
+
+  if (0u == div)
+  {
+    host_usart_fail("BRR not set");
+  }
+#if defined(USART_CR1_OVER8)
+  if (USARTx->CR1 & USART_CR1_OVER8)
+  {
+    div = (div & 0xFFF0u) | ((div & 0x7u) << 1u);
+    host_uart_rate_set((uint32_t)((2ull * HOST_PCLK) / div));
+    return;
+  }
+#endif
+  host_uart_rate_set(HOST_PCLK / div);
+}
+
+/* The USART whose data register the channel reads. */
+static USART_TypeDef *host_dma_usart(const DMA_Channel_TypeDef *channel)
+{
+  for (uint32_t i = 0u; i < 3u; i++)
+  {
+#if defined(STM32F1)
+    uintptr_t data = (uintptr_t)&host_usart[i].DR;
+#else
+    uintptr_t data = (uintptr_t)&host_usart[i].RDR;
+#endif
+    if ((uint32_t)data == channel->CPAR)
+    {
+      return &host_usart[i];
+    }
+  }
+  host_usart_fail("CPAR is no USART data register");
+  return NULL;
+}
+
+uint32_t host_dma_run(void)
+{
+  DMA_Channel_TypeDef *channel = NULL;
+  uint8_t data;
+
+  for (uint32_t i = 0u; i < 7u; i++)
+  {
+    if (host_dma[i].CCR & DMA_CCR_EN)
+    {
+      channel = &host_dma[i];
+    }
+  }
+  if (!channel)
+  {
+    host_dma_enabled = 0u;
+    return 0u;
+  }
+  if (!host_dma_enabled)
+  {
+    /* The statics have to fit the 32 bit address registers. */
+    if ((uintptr_t)channel > UINT32_MAX)
+    {
+      host_usart_fail("linked as PIE, the ring is above 4 GiB");
+    }
+    if ((DMA_CCR_MINC | DMA_CCR_CIRC) != (channel->CCR & (DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_PSIZE | DMA_CCR_MSIZE)) ||
+        (0u == channel->count[0]))
+    {
+      host_usart_fail("the RX channel is not a circular byte ring");
+    }
+    host_dma_enabled = 1u;
+    host_dma_reload = channel->count[0];
+  }
+  USART_TypeDef *usart = host_dma_usart(channel);
+  if (!(usart->CR1 & USART_CR1_UE) || !(usart->CR3 & USART_CR3_DMAR))
+  {
+    host_usart_fail("USART off or no DMA request");
+  }
+  host_usart_rate(usart);
+
+  /* Polled without a change: the CPU waits for the next byte. */
+  if ((host_dma_read_ns == host_time_ns) && (host_dma_read == channel->count[0]) &&
+      (host_dma_ticks != host_tick_reads))
+  {
+    host_uart_wait();
+  }
+  uint8_t *ring = (uint8_t *)(uintptr_t)channel->CMAR;
+  while (host_uart_arrive(&data))
+  {
+    ring[host_dma_reload - channel->count[0]] = data;
+    channel->count[0] = (1u < channel->count[0]) ? (channel->count[0] - 1u) : host_dma_reload;
+  }
+  host_dma_read_ns = host_time_ns;
+  host_dma_read = channel->count[0];
+  host_dma_ticks = host_tick_reads;
+  return 0u;
+}
+
+void LL_USART_ConfigAsyncMode(USART_TypeDef *USARTx)
+{
+  USARTx->CR2 = 0u;
+  USARTx->CR3 &= ~USART_CR3_HDSEL;
+}
+
+void LL_USART_EnableHalfDuplex(USART_TypeDef *USARTx)
+{
+  USARTx->CR3 |= USART_CR3_HDSEL;
+}
+
+void LL_USART_EnableDMAReq_RX(USART_TypeDef *USARTx)
+{
+  USARTx->CR3 |= USART_CR3_DMAR;
+}
+
+uint32_t LL_USART_IsActiveFlag_ORE(USART_TypeDef *USARTx)
+{
+  (void)USARTx;
+  return 0u;
+}
+
+void LL_USART_ClearFlag_ORE(USART_TypeDef *USARTx)
+{
+  (void)USARTx;
+}
+
+/* Polled reception is not modelled, the DMA takes every byte. */
+uint32_t LL_USART_IsActiveFlag_RXNE(USART_TypeDef *USARTx)
+{
+  (void)USARTx;
+  host_usart_fail("polled reception");
+  return 0u;
+}
+
+uint8_t LL_USART_ReceiveData8(USART_TypeDef *USARTx)
+{
+  return (uint8_t)LL_USART_IsActiveFlag_RXNE(USARTx);
+}
+
+void LL_USART_TransmitData8(USART_TypeDef *USARTx, uint8_t Value)
+{
+  if ((USART_CR1_UE | USART_CR1_TE) != (USARTx->CR1 & (USART_CR1_UE | USART_CR1_TE)))
+  {
+    host_usart_fail("transmitter off");
+  }
+  if (sizeof(host_usart_tx) <= host_usart_tx_size)
+  {
+    (void)LL_USART_IsActiveFlag_TC(USARTx);
+  }
+  host_usart_rate(USARTx);
+  host_usart_tx[host_usart_tx_size++] = Value;
+}
+
+uint32_t LL_USART_IsActiveFlag_TXE(USART_TypeDef *USARTx)
+{
+  (void)USARTx;
+  return 1u;
+}
+
+uint32_t LL_USART_IsActiveFlag_TC(USART_TypeDef *USARTx)
+{
+  (void)USARTx;
+  if (host_usart_tx_size)
+  {
+    uint32_t size = host_usart_tx_size;
+    host_usart_tx_size = 0u;
+    host_uart_send(host_usart_tx, size);
+  }
+  return 1u;
+}
+
+void LL_GPIO_SetPinMode(GPIO_TypeDef *GPIOx, uint32_t Pin, uint32_t Mode)
+{
+  GPIOx->MODER = (GPIOx->MODER & ~Pin) | ((LL_GPIO_MODE_INPUT != Mode) ? Pin : 0u);
+}
+
+void LL_GPIO_SetPinSpeed(GPIO_TypeDef *GPIOx, uint32_t Pin, uint32_t Speed)
+{
+  (void)GPIOx;
+  (void)Pin;
+  (void)Speed;
+}
+
+void LL_GPIO_SetPinPull(GPIO_TypeDef *GPIOx, uint32_t Pin, uint32_t Pull)
+{
+  GPIOx->PUPDR = (GPIOx->PUPDR & ~Pin) | ((LL_GPIO_PULL_UP == Pull) ? Pin : 0u);
+}
+
+void LL_GPIO_SetAFPin_0_7(GPIO_TypeDef *GPIOx, uint32_t Pin, uint32_t Alternate)
+{
+  (void)GPIOx;
+  (void)Pin;
+  (void)Alternate;
+}
+
+void LL_GPIO_SetAFPin_8_15(GPIO_TypeDef *GPIOx, uint32_t Pin, uint32_t Alternate)
+{
+  (void)GPIOx;
+  (void)Pin;
+  (void)Alternate;
+}
+
+/* The line idles high, a pin with a pull-up too. */
+uint32_t LL_GPIO_IsInputPinSet(GPIO_TypeDef *GPIOx, uint32_t PinMask)
+{
+  return (GPIOx->PUPDR & PinMask) ? 1u : 0u;
+}
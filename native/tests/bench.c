@@ -0,0 +1,143 @@
+/**
+ * @file    bench.c
+ * @brief   Upload session of one target env (see CMakeLists.txt) with its
+ *          protocol, line rate, half duplex turnaround and flash timing.
+ *          Checks the image was installed and reports throughput and reply
+ *          latency. The host answers on the next USB frame (1 ms). The
+ *          bytes go through the real Src/uart.c and its DMA ring, on the
+ *          register model of sim/host_usart.c.
+ */
+
+#include "main.h"
+#include "flash.h"
+#include "host.h"
+#include "uart.h"
+#if STK500
+#include "stk500.h"
+#include "stk500_peer.h"
+#elif FRSKY
+#include "frsky.h"
+#include "frsky_peer.h"
+#else
+#include "xmodem.h"
+#include "xmodem_peer.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK(cond)                                                   \
+  do                                                                  \
+  {                                                                   \
+    if (!(cond))                                                      \
+    {                                                                 \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+      return 1;                                                       \
+    }                                                                 \
+  } while (0)
+
+#define BENCH_REACTION_US 1000u
+#define BENCH_TURNAROUND_US 100u
+
+static uint8_t image[16u * 1024u + 256u];
+
+/* Random image with a vector table flash_check_app_loaded() accepts. */
+static void make_image(void)
+{
+  srand(1u);
+  for (uint32_t i = 0u; i < sizeof(image); i++)
+  {
+    image[i] = (uint8_t)rand();
+  }
+  uint32_t vectors[3] = {0x20005000u, FLASH_APP_START_ADDRESS + 0x101u, FLASH_APP_START_ADDRESS + 0x201u};
+  memcpy(image, vectors, sizeof(vectors));
+}
+
+/* A previous image is installed, its pages have to be erased. The UART is
+ * set up like at boot. */
+static void bench_reset(void)
+{
+  host_reset();
+  uart_init();
+  host_uart_turnaround_us = BENCH_TURNAROUND_US;
+  memset(host_flash_mem(FLASH_APP_START_ADDRESS), 0x5A, sizeof(image));
+}
+
+static int installed(void)
+{
+  CHECK(0 == memcmp(host_flash_mem(FLASH_APP_START_ADDRESS), image, sizeof(image)));
+  CHECK(0 == flash_check_app_loaded());
+  return 0;
+}
+
+#if STK500 || FRSKY
+
+/* The protocol loop of main.c */
+static void bench_session(void)
+{
+#if STK500
+  if (stk500_check() < 0)
+#else
+  if (frsky_check() < 0)
+#endif
+  {
+    flash_jump_to_app();
+  }
+}
+
+static int bench(void)
+{
+#if STK500
+  stk500_peer peer = {.image = image, .size = sizeof(image), .page = 256u, .reaction = BENCH_REACTION_US};
+#else
+  frsky_peer peer = {.image = image, .size = sizeof(image), .reaction = BENCH_REACTION_US};
+#endif
+
+  bench_reset();
+  /* The session holds the bootloader, it leaves once the upload is over. */
+  host_boot_end = 0u;
+#if STK500
+  stk500_peer_start(&peer);
+#else
+  frsky_peer_start(&peer);
+#endif
+  CHECK(HOST_EXIT_START == host_run(bench_session));
+  CHECK(peer.done);
+  CHECK(0 == installed());
+  host_report("session", sizeof(image), peer.end_ns - peer.start_ns);
+  return 0;
+}
+
+#else /* XMODEM */
+
+static int bench(const char *label, uint8_t window)
+{
+  xmodem_peer peer = {.image = image, .size = sizeof(image), .packet = X_PACKET_1024_SIZE,
+                      .reaction = BENCH_REACTION_US, .window = window};
+
+  bench_reset();
+  xmodem_peer_start(&peer);
+  CHECK(HOST_EXIT_START == host_run(xmodem_receive));
+  CHECK(peer.done);
+  CHECK(0 == installed());
+  host_report(label, sizeof(image), peer.end_ns - peer.start_ns);
+  return 0;
+}
+
+#endif
+
+int main(void)
+{
+  int failed = 0;
+
+  make_image();
+#if STK500 || FRSKY
+  failed |= bench();
+#else
+  failed |= bench("1K", 1u);
+#if (XMODEM_WINDOW_MAX > 1)
+  failed |= bench("1K window", XMODEM_WINDOW_MAX);
+#endif
+#endif
+  return failed;
+}
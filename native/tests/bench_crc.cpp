@@ -0,0 +1,81 @@
+/**
+ * @file    bench_crc.cpp
+ * @brief   Speed of the software CRC-16 engines on the host, over 1024 byte
+ *          packets: ns per byte and, on x86, TSC cycles per byte. Only the
+ *          ratio between the engines carries over to the Cortex-M targets,
+ *          the CRC peripheral is a model here and not timed.
+ */
+
+#include "crc_engines.h"
+#include <ctime>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_TSC 1
+#else
+#define BENCH_TSC 0
+#endif
+
+#define BENCH_PACKET 1024u
+#define BENCH_BYTES (64u * 1024u * 1024u)
+
+typedef uint16_t (*crc16_engine)(uint16_t crc, const uint8_t *data, uint32_t length);
+
+static uint8_t packet[BENCH_PACKET];
+
+static uint64_t bench_now(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t)now.tv_sec * 1000000000u) + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t bench_cycles(void)
+{
+#if BENCH_TSC
+  return __rdtsc();
+#else
+  return 0u;
+#endif
+}
+
+static void bench(const char *name, uint32_t table, crc16_engine engine, uint32_t scale)
+{
+  uint32_t packets = BENCH_BYTES / BENCH_PACKET / scale;
+  volatile uint16_t sink = 0u;
+  uint64_t best_ns = UINT64_MAX, best_cycles = UINT64_MAX;
+
+  /* Best of 5 */
+  for (uint32_t run = 0u; run < 5u; run++)
+  {
+    uint64_t start = bench_now(), cycles = bench_cycles();
+    for (uint32_t i = 0u; i < packets; i++)
+    {
+      sink = engine(0u, packet, BENCH_PACKET);
+    }
+    cycles = bench_cycles() - cycles;
+    start = bench_now() - start;
+    best_ns = (start < best_ns) ? start : best_ns;
+    best_cycles = (cycles < best_cycles) ? cycles : best_cycles;
+  }
+  (void)sink;
+  double bytes = (double)packets * BENCH_PACKET;
+  printf("%-8s table %3u B  %6.3f ns/byte", name, (unsigned)table, (double)best_ns / bytes);
+  if (BENCH_TSC)
+  {
+    printf("  %6.2f cycles/byte", (double)best_cycles / bytes);
+  }
+  printf("  %8.1f us/packet\n", (double)best_ns / packets / 1000.0);
+}
+
+int main(void)
+{
+  srand(1u);
+  for (uint32_t i = 0u; i < sizeof(packet); i++)
+  {
+    packet[i] = (uint8_t)rand();
+  }
+  bench("bitwise", 0u, crc_bitwise::crc16_update, 4u);
+  bench("nibble", 32u, crc_nibble::crc16_update, 1u);
+  bench("table", 512u, crc_table::crc16_update, 1u);
+  return 0;
+}
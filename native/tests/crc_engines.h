@@ -0,0 +1,190 @@
+/**
+ * @file    crc_engines.h
+ * @brief   All CRC engines of Src/crc.c in one host program (C++): crc.c is
+ *          built once per CRC16_IMPL, each in its own namespace, the
+ *          peripheral backends against a model of the STM32 CRC unit.
+ *
+ *          The model: a write to the data register shifts in as many bits as
+ *          the access is wide, MSB first, CR RESET loads INIT. With a
+ *          programmable unit (CRC_PROGRAMMABLE) POL and CR POLYSIZE select
+ *          a 32, 16, 8 or 7 bit polynomial. The fixed unit (F1, L1) has no
+ *          POL and INIT, it is CRC-32 only and resets to 0xFFFFFFFF.
+ *
+ *          Built with CRC16_IMPL=CRC16_HW and CRC32_HW=1, so that crc.h
+ *          declares crc_init().
+ */
+
+#ifndef CRC_ENGINES_H_
+#define CRC_ENGINES_H_
+
+#include "crc.h"
+#include "main.h"
+#include <cstdio>
+#include <cstdlib>
+
+#define CRC_CR_RESET 0x01u
+#define CRC_CR_POLYSIZE 0x18u
+#define CRC_CR_POLYSIZE_0 0x08u
+#define CRC_CR_POLYSIZE_1 0x10u
+#define CRC_CR_REV 0xE0u /* REV_IN, REV_OUT: not modelled */
+
+#define __REV(value) __builtin_bswap32(value)
+
+struct host_crc_state
+{
+  uint8_t clock;       /**< __HAL_RCC_CRC_CLK_ENABLE() */
+  uint32_t value;      /**< CRC register */
+  uint32_t control;
+  uint32_t polynomial;
+  uint32_t init;
+  uint32_t bytes;      /**< Data fed since the start, statistics. */
+};
+static host_crc_state host_crc_unit = {0u, 0xFFFFFFFFu, 0u, 0x04C11DB7u, 0xFFFFFFFFu, 0u};
+
+static void host_crc_fail(const char *what)
+{
+  fprintf(stderr, "CRC unit: %s\n", what);
+  abort();
+}
+
+static uint32_t host_crc_size(void)
+{
+  static const uint32_t size[4] = {32u, 16u, 8u, 7u};
+  return size[(host_crc_unit.control & CRC_CR_POLYSIZE) / CRC_CR_POLYSIZE_0];
+}
+
+static uint32_t host_crc_mask(void)
+{
+  return (32u == host_crc_size()) ? 0xFFFFFFFFu : ((1u << host_crc_size()) - 1u);
+}
+
+static void host_crc_feed(uint32_t data, uint32_t width)
+{
+  uint32_t size = host_crc_size();
+
+  if (!host_crc_unit.clock)
+  {
+    host_crc_fail("not clocked");
+  }
+  for (uint32_t bit = width; bit--;)
+  {
+    uint32_t top = ((host_crc_unit.value >> (size - 1u)) ^ (data >> bit)) & 1u;
+    host_crc_unit.value = (host_crc_unit.value << 1u) & host_crc_mask();
+    if (top)
+    {
+      host_crc_unit.value ^= host_crc_unit.polynomial & host_crc_mask();
+    }
+  }
+  host_crc_unit.bytes += width / 8u;
+}
+
+/* DR: 32 bit writes and reads. */
+struct host_crc_dr
+{
+  host_crc_dr &operator=(uint32_t data)
+  {
+    host_crc_feed(data, 32u);
+    return *this;
+  }
+  operator uint32_t() const
+  {
+    return host_crc_unit.value & host_crc_mask();
+  }
+};
+
+/* DR as a byte (CRC_DR_BYTE). */
+struct host_crc_dr8
+{
+  host_crc_dr8 &operator=(uint8_t data)
+  {
+    host_crc_feed(data, 8u);
+    return *this;
+  }
+};
+
+struct host_crc_cr
+{
+  host_crc_cr &operator=(uint32_t control)
+  {
+    if (!host_crc_unit.clock)
+    {
+      host_crc_fail("not clocked");
+    }
+#if !CRC_PROGRAMMABLE
+    if (control & ~CRC_CR_RESET)
+    {
+      host_crc_fail("fixed unit, only RESET in CR");
+    }
+#endif
+    if (control & CRC_CR_REV)
+    {
+      host_crc_fail("bit reversal is not modelled");
+    }
+    host_crc_unit.control = control & ~CRC_CR_RESET;
+    if (control & CRC_CR_RESET)
+    {
+      host_crc_unit.value = host_crc_unit.init & host_crc_mask();
+    }
+    return *this;
+  }
+};
+
+/* POL and INIT */
+template <uint32_t host_crc_state::*field>
+struct host_crc_setting
+{
+  host_crc_setting &operator=(uint32_t value)
+  {
+    host_crc_unit.*field = value;
+    return *this;
+  }
+};
+
+struct host_crc_registers
+{
+  host_crc_dr DR;
+  host_crc_dr8 DR8;
+  host_crc_cr CR;
+#if CRC_PROGRAMMABLE
+  host_crc_setting<&host_crc_state::polynomial> POL;
+  host_crc_setting<&host_crc_state::init> INIT;
+#endif
+};
+static host_crc_registers host_crc_regs;
+
+#define CRC (&host_crc_regs)
+#define CRC_DR_BYTE (CRC->DR8)
+#define __HAL_RCC_CRC_CLK_ENABLE() (host_crc_unit.clock = 1u)
+
+/* The peripheral backends, CRC-16 falls back to the nibble table on a fixed
+ * unit. */
+namespace crc_hw
+{
+#include "crc.c"
+}
+
+#undef CRC16_IMPL
+#undef CRC32_HW
+#define CRC32_HW 0
+
+#define CRC16_IMPL CRC16_BITWISE
+namespace crc_bitwise
+{
+#include "crc.c"
+}
+#undef CRC16_IMPL
+
+#define CRC16_IMPL CRC16_NIBBLE
+namespace crc_nibble
+{
+#include "crc.c"
+}
+#undef CRC16_IMPL
+
+#define CRC16_IMPL CRC16_TABLE
+namespace crc_table
+{
+#include "crc.c"
+}
+
+#endif /* CRC_ENGINES_H_ */
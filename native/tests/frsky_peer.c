@@ -0,0 +1,166 @@
+/**
+ * @file    frsky_peer.c
+ * @brief   Uploading side of the FrSky protocol for the host tests.
+ */
+
+#include "frsky_peer.h"
+#include "host.h"
+#include <string.h>
+
+#define PEER_START 0x7Eu
+#define PEER_STUFF 0x7Du
+#define PEER_TX_BYTE 0xFFu
+#define PEER_RX_BYTE 0x5Eu
+#define PEER_HEAD 0x50u
+
+enum
+{
+  PEER_POWERUP = 0x00u,
+  PEER_VERSION = 0x01u,
+  PEER_DOWNLOAD = 0x03u,
+  PEER_DATA_WORD = 0x04u,
+  PEER_DATA_EOF = 0x05u
+};
+
+enum
+{
+  PEER_ACK_POWERUP = 0x80u,
+  PEER_ACK_VERSION = 0x81u,
+  PEER_DATA_ADDR = 0x82u,
+  PEER_END_DOWNLOAD = 0x83u,
+  PEER_CRC_ERR = 0x84u
+};
+
+/* CRC of the frames, frsky.c */
+uint16_t crc16(const uint8_t *data_p, uint8_t length);
+
+static frsky_peer *peer;
+static uint8_t peer_last[16u]; /**< Last request, sent again on a CRC error. */
+static uint32_t peer_last_size;
+static uint8_t peer_frame[8u]; /**< Answer collected so far. */
+static uint8_t peer_frame_size;
+static uint8_t peer_in_frame; /**< 1 after the start byte, 2 in an answer. */
+static uint8_t peer_stuffed;
+
+static void peer_send(uint8_t command, uint32_t address)
+{
+  uint8_t frame[8u] = {PEER_HEAD, command};
+  uint32_t length = 0u;
+
+  if (PEER_DATA_WORD == command)
+  {
+    /* The file header, then the image. */
+    for (uint32_t i = 0u; i < 4u; i++)
+    {
+      uint32_t offset = address + i;
+      frame[2u + i] = (offset < FRSKY_PEER_HEADER) ? 0u : peer->image[offset - FRSKY_PEER_HEADER];
+    }
+    frame[6u] = (uint8_t)address;
+  }
+  frame[7u] = (uint8_t)crc16(frame, 7u);
+
+  peer_last[length++] = PEER_START;
+  peer_last[length++] = PEER_TX_BYTE;
+  for (uint32_t i = 0u; i < sizeof(frame); i++)
+  {
+    if ((PEER_START == frame[i]) || (PEER_STUFF == frame[i]))
+    {
+      peer_last[length++] = PEER_STUFF;
+      peer_last[length++] = frame[i] ^ 0x20u;
+    }
+    else
+    {
+      peer_last[length++] = frame[i];
+    }
+  }
+  peer_last_size = length;
+  host_uart_feed_after(peer->reaction, peer_last, length);
+}
+
+static void peer_answer(void)
+{
+  uint32_t address;
+
+  switch (peer_frame[1u])
+  {
+  case PEER_ACK_POWERUP:
+    peer_send(PEER_VERSION, 0u);
+    break;
+  case PEER_ACK_VERSION:
+    peer_send(PEER_DOWNLOAD, 0u);
+    break;
+  case PEER_DATA_ADDR:
+    memcpy(&address, &peer_frame[2u], sizeof(address));
+    if (address < (FRSKY_PEER_HEADER + peer->size))
+    {
+      peer_send(PEER_DATA_WORD, address);
+    }
+    else
+    {
+      peer_send(PEER_DATA_EOF, 0u);
+    }
+    break;
+  case PEER_END_DOWNLOAD:
+    peer->done = 1u;
+    peer->end_ns = host_time_ns;
+    break;
+  case PEER_CRC_ERR:
+    peer->crc_errors++;
+    host_uart_feed_after(peer->reaction, peer_last, peer_last_size);
+    break;
+  default:
+    break;
+  }
+}
+
+static void peer_receive(const uint8_t *data, uint32_t length)
+{
+  while (length--)
+  {
+    uint8_t ch = *data++;
+    if (PEER_START == ch)
+    {
+      peer_in_frame = 1u;
+      peer_frame_size = 0u;
+      peer_stuffed = 0u;
+      continue;
+    }
+    if (1u == peer_in_frame)
+    {
+      /* Only the answers of the receiver. */
+      peer_in_frame = (PEER_RX_BYTE == ch) ? 2u : 0u;
+      continue;
+    }
+    if (!peer_in_frame)
+    {
+      continue;
+    }
+    if (PEER_STUFF == ch)
+    {
+      peer_stuffed = 1u;
+      continue;
+    }
+    peer_frame[peer_frame_size++] = peer_stuffed ? (ch ^ 0x20u) : ch;
+    peer_stuffed = 0u;
+    if (sizeof(peer_frame) == peer_frame_size)
+    {
+      peer_in_frame = 0u;
+      if (((uint8_t)(crc16(peer_frame, 7u) >> 8u) == peer_frame[7u]) && (PEER_HEAD == peer_frame[0u]))
+      {
+        peer_answer();
+      }
+    }
+  }
+}
+
+void frsky_peer_start(frsky_peer *config)
+{
+  peer = config;
+  peer->done = 0u;
+  peer->crc_errors = 0u;
+  peer->start_ns = host_time_ns;
+  peer->end_ns = 0u;
+  peer_in_frame = 0u;
+  host_uart_peer = peer_receive;
+  peer_send(PEER_POWERUP, 0u);
+}
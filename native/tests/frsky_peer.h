@@ -0,0 +1,29 @@
+/**
+ * @file    frsky_peer.h
+ * @brief   Uploading side of the FrSky protocol for the host tests: power up,
+ *          version, download, then one data word per requested address
+ *          (the first FRSKY_PEER_HEADER bytes are the file header), EOF.
+ */
+
+#ifndef FRSKY_PEER_H_
+#define FRSKY_PEER_H_
+
+#include <stdint.h>
+
+#define FRSKY_PEER_HEADER 16u
+
+typedef struct
+{
+  const uint8_t *image; /**< Without the file header, whole words. */
+  uint32_t size;
+  uint32_t reaction;    /**< us until the host answers. */
+  /* Results */
+  uint8_t done;         /**< EOF was answered with END_DOWNLOAD. */
+  uint32_t crc_errors;  /**< DATA_CRC_ERR answers. */
+  uint64_t start_ns;    /**< First byte sent. */
+  uint64_t end_ns;      /**< END_DOWNLOAD received. */
+} frsky_peer;
+
+void frsky_peer_start(frsky_peer *peer);
+
+#endif /* FRSKY_PEER_H_ */
@@ -0,0 +1,164 @@
+/**
+ * @file    fuzz_corpus.c
+ * @brief   Seeds for the fuzz targets: what the uploading peers send in
+ *          complete sessions (XMODEM 128 and 1K, windowed; STK500; FrSky),
+ *          plus the XMODEM extended commands one by one.
+ *
+ *          fuzz_corpus dir    -> dir/xmodem, dir/stk500, dir/frsky
+ */
+
+#include "xmodem.h"
+#include "stk500.h"
+#include "frsky.h"
+#include "flash.h"
+#include "crc.h"
+#include "host.h"
+#include "xmodem_peer.h"
+#include "stk500_peer.h"
+#include "frsky_peer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static uint8_t image[2048u];
+static char path[4096];
+
+/* Random image with a vector table flash_check_app_loaded() accepts. */
+static void make_image(uint32_t size)
+{
+  srand(size);
+  for (uint32_t i = 0u; i < size; i++)
+  {
+    image[i] = (uint8_t)rand();
+  }
+  uint32_t vectors[3] = {0x20005000u, FLASH_APP_START_ADDRESS + 0x101u, FLASH_APP_START_ADDRESS + 0x201u};
+  memcpy(image, vectors, sizeof(vectors));
+}
+
+static FILE *seed_open(const char *dir, const char *target, const char *name)
+{
+  snprintf(path, sizeof(path), "%s/%s", dir, target);
+  mkdir(path, 0755);
+  snprintf(path, sizeof(path), "%s/%s/%s", dir, target, name);
+  FILE *file = fopen(path, "wb");
+  if (!file)
+  {
+    perror(path);
+    exit(1);
+  }
+  return file;
+}
+
+static void session_stk500(void)
+{
+  if (stk500_check() < 0)
+  {
+    flash_jump_to_app();
+  }
+}
+
+static void session_frsky(void)
+{
+  if (frsky_check() < 0)
+  {
+    flash_jump_to_app();
+  }
+}
+
+/* Everything the peer sends in the session goes to the seed, the recording
+ * starts before the peer (STK500 and FrSky speak first). */
+static void record(const char *target, const char *name, void (*session)(void))
+{
+  int code = host_run(session);
+  if (HOST_EXIT_START != code)
+  {
+    fprintf(stderr, "%s/%s: the session did not complete (exit %d)\n", target, name, code);
+    exit(1);
+  }
+  fclose(host_uart_record);
+  host_uart_record = NULL;
+}
+
+static void seed_xmodem(const char *dir, const char *name, uint32_t size, uint16_t packet, uint8_t window)
+{
+  xmodem_peer peer = {.image = image, .size = size, .packet = packet, .reaction = 50u, .window = window};
+
+  make_image(size);
+  flash_session_abort();
+  host_reset();
+  host_uart_record = seed_open(dir, "xmodem", name);
+  xmodem_peer_start(&peer);
+  record("xmodem", name, xmodem_receive);
+}
+
+static void put_command(FILE *file, uint8_t id, const uint32_t *payload, uint16_t words)
+{
+  uint16_t length = (uint16_t)(words * 4u);
+  uint8_t header[X_CMD_HEADER_SIZE] = {id, (uint8_t)length, (uint8_t)(length >> 8u)};
+  uint16_t crc = crc16_update(crc16_update(0u, header, X_CMD_HEADER_SIZE), (const uint8_t *)payload, length);
+  uint8_t trailer[2] = {(uint8_t)(crc >> 8u), (uint8_t)crc};
+
+  fputc(X_CMD, file);
+  fwrite(header, 1u, sizeof(header), file);
+  fwrite(payload, 1u, length, file);
+  fwrite(trailer, 1u, sizeof(trailer), file);
+}
+
+/* The commands an uploader sends before and after the packets. */
+static void seed_commands(const char *dir)
+{
+  const uint32_t none[1] = {0u};
+  const uint32_t version[1] = {0x01020304u};
+  const uint32_t read[2] = {FLASH_APP_START_ADDRESS, 64u};
+  const uint32_t check[4] = {FLASH_APP_START_ADDRESS, 1024u, FLASH_APP_START_ADDRESS + 1024u, 1024u};
+  const uint32_t seek[2] = {0u, 4096u};
+  const uint32_t resume[2] = {4096u, 0x12345678u};
+  const uint32_t baud[2] = {921600u, 115200u};
+  FILE *file = seed_open(dir, "xmodem", "commands");
+
+  put_command(file, X_CMD_INFO, none, 0u);
+  put_command(file, X_CMD_STATS, none, 0u);
+  put_command(file, X_CMD_VERSION, version, 1u);
+  put_command(file, X_CMD_READ, read, 2u);
+  put_command(file, X_CMD_CHECK, check, 4u);
+  put_command(file, X_CMD_SEEK, seek, 2u);
+  put_command(file, X_CMD_RESUME, resume, 2u);
+  put_command(file, X_CMD_BAUD, baud, 2u);
+  fputc(X_EOT, file);
+  fclose(file);
+}
+
+int main(int argc, char **argv)
+{
+  if (2 != argc)
+  {
+    fprintf(stderr, "usage: %s dir\n", argv[0]);
+    return 2;
+  }
+  mkdir(argv[1], 0755);
+
+  seed_xmodem(argv[1], "128", 1024u, X_PACKET_128_SIZE, 1u);
+  seed_xmodem(argv[1], "1k", 2048u, X_PACKET_1024_SIZE, 1u);
+  seed_xmodem(argv[1], "window", 2048u, X_PACKET_1024_SIZE, 3u);
+  seed_commands(argv[1]);
+
+  stk500_peer stk500 = {.image = image, .size = 1024u, .page = 128u, .reaction = 50u};
+  make_image(stk500.size);
+  flash_session_abort();
+  host_reset();
+  host_boot_end = 0u;
+  host_uart_record = seed_open(argv[1], "stk500", "session");
+  stk500_peer_start(&stk500);
+  record("stk500", "session", session_stk500);
+
+  frsky_peer frsky = {.image = image, .size = 512u, .reaction = 50u};
+  make_image(frsky.size);
+  flash_session_abort();
+  host_reset();
+  host_boot_end = 0u;
+  host_uart_record = seed_open(argv[1], "frsky", "session");
+  frsky_peer_start(&frsky);
+  record("frsky", "session", session_frsky);
+  return 0;
+}
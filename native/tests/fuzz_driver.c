@@ -0,0 +1,220 @@
+/**
+ * @file    fuzz_driver.c
+ * @brief   Runs a LLVMFuzzerTestOneInput() target without libFuzzer (gcc
+ *          builds): every file of the corpus directories, then random
+ *          mutations of them (bit flips, byte changes, insertions, deletions,
+ *          splices). There is no coverage feedback, but a run is repeatable
+ *          for a seed. A crashing or hanging input is saved as crash-input.
+ *
+ *          fuzz_<target> [-runs=N] [-seed=S] [-timeout=s] corpus_dir...
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FUZZ_CORPUS_MAX 256u
+#define FUZZ_INPUT_MAX 0x8000u
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+typedef struct
+{
+  uint8_t *data;
+  size_t size;
+} fuzz_input;
+
+static fuzz_input corpus[FUZZ_CORPUS_MAX];
+static uint32_t corpus_size;
+static uint8_t current[FUZZ_INPUT_MAX];
+static size_t current_size;
+static uint32_t seed = 1u;
+
+static uint32_t fuzz_random(void)
+{
+  /* xorshift32 */
+  seed ^= seed << 13u;
+  seed ^= seed >> 17u;
+  seed ^= seed << 5u;
+  return seed;
+}
+
+/* Keeps the input that failed, only async-signal-safe calls. */
+static void fuzz_crash(int signal)
+{
+  static const char name[] = "crash-input";
+  static const char message[] = "fuzz: input saved as crash-input\n";
+  int fd = creat(name, 0644);
+  if (0 <= fd)
+  {
+    (void)!write(fd, current, current_size);
+    close(fd);
+  }
+  (void)!write(STDERR_FILENO, message, sizeof(message) - 1u);
+  _exit(128 + signal);
+}
+
+static void fuzz_load(const char *path)
+{
+  DIR *dir = opendir(path);
+  struct dirent *entry;
+  char name[4096];
+
+  if (!dir)
+  {
+    perror(path);
+    exit(2);
+  }
+  while ((entry = readdir(dir)) && (corpus_size < FUZZ_CORPUS_MAX))
+  {
+    if ('.' == entry->d_name[0])
+    {
+      continue;
+    }
+    snprintf(name, sizeof(name), "%s/%s", path, entry->d_name);
+    FILE *file = fopen(name, "rb");
+    if (!file)
+    {
+      continue;
+    }
+    fuzz_input *input = &corpus[corpus_size];
+    input->data = malloc(FUZZ_INPUT_MAX);
+    input->size = fread(input->data, 1u, FUZZ_INPUT_MAX, file);
+    fclose(file);
+    corpus_size++;
+  }
+  closedir(dir);
+}
+
+static void fuzz_run(void)
+{
+  (void)LLVMFuzzerTestOneInput(current, current_size);
+}
+
+static void fuzz_mutate(void)
+{
+  static const uint8_t interesting[] = {0x00u, 0x01u, 0x02u, 0x04u, 0x05u, 0x7Du, 0x7Eu, 0x7Fu, 0x80u, 0xFFu};
+  uint32_t count = 1u + (fuzz_random() % 4u);
+
+  while (count--)
+  {
+    size_t at = current_size ? (fuzz_random() % current_size) : 0u;
+    switch (fuzz_random() % 7u)
+    {
+    case 0:
+      if (current_size)
+      {
+        current[at] ^= (uint8_t)(1u << (fuzz_random() % 8u));
+      }
+      break;
+    case 1:
+      if (current_size)
+      {
+        current[at] = (uint8_t)fuzz_random();
+      }
+      break;
+    case 2:
+      if (current_size)
+      {
+        current[at] = interesting[fuzz_random() % sizeof(interesting)];
+      }
+      break;
+    case 3:
+      if (current_size < FUZZ_INPUT_MAX)
+      {
+        memmove(&current[at + 1u], &current[at], current_size - at);
+        current[at] = (uint8_t)fuzz_random();
+        current_size++;
+      }
+      break;
+    case 4:
+      if (current_size)
+      {
+        size_t length = 1u + (fuzz_random() % (current_size - at));
+        memmove(&current[at], &current[at + length], current_size - at - length);
+        current_size -= length;
+      }
+      break;
+    case 5:
+    {
+      /* The tail of another input from here on. */
+      const fuzz_input *other = &corpus[fuzz_random() % corpus_size];
+      if (other->size)
+      {
+        size_t from = fuzz_random() % other->size;
+        size_t length = other->size - from;
+        if (length > (FUZZ_INPUT_MAX - at))
+        {
+          length = FUZZ_INPUT_MAX - at;
+        }
+        memcpy(&current[at], &other->data[from], length);
+        current_size = at + length;
+      }
+      break;
+    }
+    default:
+      /* Cut short */
+      current_size = at;
+      break;
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long runs = 1000u, timeout = 10u;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (0 == strncmp(argv[i], "-runs=", 6u))
+    {
+      runs = strtoul(&argv[i][6], NULL, 0);
+    }
+    else if (0 == strncmp(argv[i], "-seed=", 6u))
+    {
+      seed = (uint32_t)strtoul(&argv[i][6], NULL, 0) | 1u;
+    }
+    else if (0 == strncmp(argv[i], "-timeout=", 9u))
+    {
+      timeout = strtoul(&argv[i][9], NULL, 0);
+    }
+    else if ('-' == argv[i][0])
+    {
+      fprintf(stderr, "usage: %s [-runs=N] [-seed=S] [-timeout=s] corpus_dir...\n", argv[0]);
+      return 2;
+    }
+    else
+    {
+      fuzz_load(argv[i]);
+    }
+  }
+  signal(SIGABRT, fuzz_crash);
+  signal(SIGSEGV, fuzz_crash);
+  signal(SIGALRM, fuzz_crash);
+
+  /* The seeds as they are, then the mutations. */
+  for (uint32_t i = 0u; i < corpus_size; i++)
+  {
+    memcpy(current, corpus[i].data, corpus[i].size);
+    current_size = corpus[i].size;
+    alarm((unsigned)timeout);
+    fuzz_run();
+  }
+  for (unsigned long run = 0u; corpus_size && (run < runs); run++)
+  {
+    const fuzz_input *base = &corpus[fuzz_random() % corpus_size];
+    memcpy(current, base->data, base->size);
+    current_size = base->size;
+    fuzz_mutate();
+    alarm((unsigned)timeout);
+    fuzz_run();
+  }
+  alarm(0u);
+  printf("%u seeds, %lu mutations, no failure\n", (unsigned)corpus_size, corpus_size ? runs : 0u);
+  return corpus_size ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+/**
+ * @file    fuzz_frsky.c
+ * @brief   Fuzz target: readFrame() and process_frame() through frsky_check()
+ *          on any input, the session leaves like in main.c.
+ */
+
+#include "frsky.h"
+#include "flash.h"
+#include "host.h"
+#include "script.h"
+#include <stdlib.h>
+
+#define FUZZ_MAX_INPUT 0x8000u
+
+static void fuzz_session(void)
+{
+  if (frsky_check() < 0)
+  {
+    flash_jump_to_app();
+  }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  if (FUZZ_MAX_INPUT < size)
+  {
+    return 0;
+  }
+  script_start(data, (uint32_t)size, 500u);
+  host_boot_end = 0u;
+  if (0 != script_check(host_run(fuzz_session)))
+  {
+    abort();
+  }
+  return 0;
+}
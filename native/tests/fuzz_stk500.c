@@ -0,0 +1,36 @@
+/**
+ * @file    fuzz_stk500.c
+ * @brief   Fuzz target: stk500_update() through stk500_check() on any input,
+ *          the session leaves like in main.c.
+ */
+
+#include "stk500.h"
+#include "flash.h"
+#include "host.h"
+#include "script.h"
+#include <stdlib.h>
+
+#define FUZZ_MAX_INPUT 0x8000u
+
+static void fuzz_session(void)
+{
+  if (stk500_check() < 0)
+  {
+    flash_jump_to_app();
+  }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  if (FUZZ_MAX_INPUT < size)
+  {
+    return 0;
+  }
+  script_start(data, (uint32_t)size, 100u);
+  host_boot_end = 0u;
+  if (0 != script_check(host_run(fuzz_session)))
+  {
+    abort();
+  }
+  return 0;
+}
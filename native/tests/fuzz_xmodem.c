@@ -0,0 +1,26 @@
+/**
+ * @file    fuzz_xmodem.c
+ * @brief   Fuzz target: the XMODEM receiver (xmodem_handle_packet(), the
+ *          extended commands, compressed and delta streams) on any input.
+ */
+
+#include "xmodem.h"
+#include "host.h"
+#include "script.h"
+#include <stdlib.h>
+
+#define FUZZ_MAX_INPUT 0x8000u
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  if (FUZZ_MAX_INPUT < size)
+  {
+    return 0;
+  }
+  script_start(data, (uint32_t)size, 100u);
+  if (0 != script_check(host_run(xmodem_receive)))
+  {
+    abort();
+  }
+  return 0;
+}
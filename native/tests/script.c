@@ -0,0 +1,59 @@
+/**
+ * @file    script.c
+ * @brief   Scripted sessions for the parser tests and the fuzz targets.
+ */
+
+#include "script.h"
+#include "flash.h"
+#include "host.h"
+#include <stdio.h>
+#include <string.h>
+
+uint8_t script_out[SCRIPT_OUT_SIZE];
+uint32_t script_out_size;
+
+static void script_record(const uint8_t *data, uint32_t length)
+{
+  while (length--)
+  {
+    if (script_out_size < SCRIPT_OUT_SIZE)
+    {
+      script_out[script_out_size] = *data;
+    }
+    script_out_size++;
+    data++;
+  }
+}
+
+void script_start(const uint8_t *input, uint32_t length, uint32_t idle_ms)
+{
+  /* The RAM state of the previous run is gone after a reset. */
+  flash_session_abort();
+  host_reset();
+  host_uart_idle_limit = idle_ms;
+  host_uart_peer = script_record;
+  script_out_size = 0u;
+  host_uart_feed(input, length);
+}
+
+int script_check(int exit_code)
+{
+  const uint8_t erased = (uint8_t)FLASH_ERASED_WORD;
+  const uint8_t *flash = host_flash_mem(FLASH_BASE);
+
+  /* A run starts on a blank flash, the bootloader part stays blank. */
+  for (uint32_t i = 0u; i < (FLASH_SESSION_ADDRESS - FLASH_BASE); i++)
+  {
+    if (erased != flash[i])
+    {
+      fprintf(stderr, "bootloader area written at 0x%08X\n", (unsigned)(FLASH_BASE + i));
+      return 1;
+    }
+  }
+  if ((HOST_EXIT_START != exit_code) && (0 == flash_check_app_loaded()))
+  {
+    fprintf(stderr, "startable image left by an unfinished session (exit %d)\n", exit_code);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,26 @@
+/**
+ * @file    script.h
+ * @brief   Scripted sessions for the parser tests and the fuzz targets: the
+ *          whole input is on the line from the start (at the line rate) and
+ *          everything the bootloader sends is recorded.
+ */
+
+#ifndef SCRIPT_H_
+#define SCRIPT_H_
+
+#include <stdint.h>
+
+#define SCRIPT_OUT_SIZE 0x4000u
+
+extern uint8_t script_out[SCRIPT_OUT_SIZE];
+extern uint32_t script_out_size; /**< Bytes sent, also those past the buffer. */
+
+/* Fresh board and flash, the input queued, idle_ms of silence end the run. */
+void script_start(const uint8_t *input, uint32_t length, uint32_t idle_ms);
+
+/* What malformed input must never do: write outside the application and its
+ * session page, or leave a startable image without a completed session.
+ * Returns 0 if the run (host_run() result) was clean. */
+int script_check(int exit_code);
+
+#endif /* SCRIPT_H_ */
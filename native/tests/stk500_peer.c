@@ -0,0 +1,118 @@
+/**
+ * @file    stk500_peer.c
+ * @brief   Uploading side of STK500 for the host tests.
+ */
+
+#include "stk500_peer.h"
+#include "stk500.h"
+#include "host.h"
+#include <string.h>
+
+enum
+{
+  PEER_SYNC,
+  PEER_ADDRESS,
+  PEER_PAGE,
+  PEER_LEAVE,
+  PEER_DONE
+};
+
+static stk500_peer *peer;
+static uint8_t peer_state;
+static uint32_t peer_offset; /**< Next page of the image. */
+static uint8_t peer_answer;  /**< Bytes of the INSYNC, OK/FAILED answer seen. */
+
+static void peer_send(void)
+{
+  uint8_t frame[5u + 512u + 1u];
+  uint32_t length = 0u;
+
+  switch (peer_state)
+  {
+  case PEER_SYNC:
+    frame[length++] = STK_GET_SYNC;
+    break;
+  case PEER_ADDRESS:
+  {
+    uint32_t word = peer_offset >> 1u;
+    frame[length++] = STK_LOAD_ADDRESS;
+    frame[length++] = (uint8_t)word;
+    frame[length++] = (uint8_t)(word >> 8u);
+    break;
+  }
+  case PEER_PAGE:
+  {
+    uint32_t size = peer->size - peer_offset;
+    if (size > peer->page)
+    {
+      size = peer->page;
+    }
+    frame[length++] = STK_PROG_PAGE;
+    frame[length++] = (uint8_t)(size >> 8u);
+    frame[length++] = (uint8_t)size;
+    frame[length++] = 'F';
+    memcpy(&frame[length], &peer->image[peer_offset], size);
+    length += size;
+    peer_offset += size;
+    break;
+  }
+  default:
+    frame[length++] = STK_LEAVE_PROGMODE;
+    break;
+  }
+  frame[length++] = CRC_EOP;
+  host_uart_feed_after(peer->reaction, frame, length);
+}
+
+static void peer_receive(const uint8_t *data, uint32_t length)
+{
+  while (length--)
+  {
+    uint8_t ch = *data++;
+    if (0u == peer_answer)
+    {
+      if (STK_INSYNC == ch)
+      {
+        peer_answer = 1u;
+      }
+      continue;
+    }
+    peer_answer = 0u;
+    if (STK_FAILED == ch)
+    {
+      peer->failed++;
+    }
+    switch (peer_state)
+    {
+    case PEER_SYNC:
+      peer_state = PEER_ADDRESS;
+      break;
+    case PEER_ADDRESS:
+      peer_state = PEER_PAGE;
+      break;
+    case PEER_PAGE:
+      peer_state = (peer_offset < peer->size) ? PEER_ADDRESS : PEER_LEAVE;
+      break;
+    default:
+      peer->done = 1u;
+      peer->end_ns = host_time_ns;
+      peer_state = PEER_DONE;
+      return;
+    }
+    peer_send();
+  }
+}
+
+void stk500_peer_start(stk500_peer *config)
+{
+  peer = config;
+  peer->done = 0u;
+  peer->failed = 0u;
+  peer->start_ns = host_time_ns;
+  peer->end_ns = 0u;
+  peer_state = PEER_SYNC;
+  peer_offset = 0u;
+  peer_answer = 0u;
+  host_uart_peer = peer_receive;
+  peer_send();
+}
@@ -0,0 +1,28 @@
+/**
+ * @file    stk500_peer.h
+ * @brief   Uploading side of STK500 for the host tests, the command sequence
+ *          avrdude uses to write the flash (sync, then load address and
+ *          program page per page, leave programming mode).
+ */
+
+#ifndef STK500_PEER_H_
+#define STK500_PEER_H_
+
+#include <stdint.h>
+
+typedef struct
+{
+  const uint8_t *image;
+  uint32_t size;
+  uint16_t page;      /**< Bytes per program page. */
+  uint32_t reaction;  /**< us until the host answers. */
+  /* Results */
+  uint8_t done;       /**< Leave programming mode was answered. */
+  uint32_t failed;    /**< STK_FAILED answers. */
+  uint64_t start_ns;  /**< First byte sent. */
+  uint64_t end_ns;    /**< Last answer. */
+} stk500_peer;
+
+void stk500_peer_start(stk500_peer *peer);
+
+#endif /* STK500_PEER_H_ */
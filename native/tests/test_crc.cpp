@@ -0,0 +1,116 @@
+/**
+ * @file    test_crc.cpp
+ * @brief   The CRC peripheral backends (see crc_engines.h) give the same
+ *          results as the software engines, bit for bit: CRC-16 over every
+ *          length and alignment of a packet, chained, and CRC-32 of images
+ *          in pieces, interleaved with each other and with CRC-16 packets.
+ */
+
+#include "crc_engines.h"
+#include <cstring>
+
+#define CHECK(cond)                                                   \
+  do                                                                  \
+  {                                                                   \
+    if (!(cond))                                                      \
+    {                                                                 \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+      return 1;                                                       \
+    }                                                                 \
+  } while (0)
+
+static uint8_t data[1100u + 4u] __attribute__((aligned(4)));
+static uint32_t words[2][300u];
+
+static void make_data(void)
+{
+  srand(1u);
+  for (uint32_t i = 0u; i < sizeof(data); i++)
+  {
+    data[i] = (uint8_t)rand();
+  }
+  for (uint32_t i = 0u; i < (sizeof(words) / 4u); i++)
+  {
+    words[i / 300u][i % 300u] = ((uint32_t)rand() << 16u) ^ (uint32_t)rand();
+  }
+}
+
+static int crc16_engines(void)
+{
+  static const uint8_t check[9] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+
+  /* CRC-16/XMODEM check value */
+  CHECK(0x31C3u == crc_hw::crc16_update(0u, check, sizeof(check)));
+  CHECK(0x31C3u == crc_bitwise::crc16_update(0u, check, sizeof(check)));
+  CHECK(0x31C3u == crc_nibble::crc16_update(0u, check, sizeof(check)));
+  CHECK(0x31C3u == crc_table::crc16_update(0u, check, sizeof(check)));
+
+  for (uint32_t offset = 0u; offset < 4u; offset++)
+  {
+    for (uint32_t length = 0u; length <= 1100u; length++)
+    {
+      uint16_t start = (uint16_t)(length * 0x9E37u);
+      const uint8_t *packet = &data[offset];
+      uint16_t expected = crc_bitwise::crc16_update(start, packet, length);
+      CHECK(expected == crc_nibble::crc16_update(start, packet, length));
+      CHECK(expected == crc_table::crc16_update(start, packet, length));
+      CHECK(expected == crc_hw::crc16_update(start, packet, length));
+    }
+  }
+  /* Header and payload in two calls, like the extended command frames. */
+  uint16_t crc = crc_hw::crc16_update(0u, data, 3u);
+  CHECK(crc_bitwise::crc16_update(0u, data, 1027u) == crc_hw::crc16_update(crc, &data[3], 1024u));
+  return 0;
+}
+
+static int crc32_engines(void)
+{
+  uint32_t expected[2], crc[2];
+
+  /* Whole images */
+  for (uint32_t length = 0u; length <= 300u; length++)
+  {
+    CHECK(crc_bitwise::crc32_update(CRC32_INIT, words[0], length) ==
+          crc_hw::crc32_update(CRC32_INIT, words[0], length));
+  }
+
+  /* Two images in pieces, taking turns, a CRC-16 packet in between: on a
+   * fixed unit the second one goes on in software. */
+  for (uint32_t i = 0u; i < 2u; i++)
+  {
+    expected[i] = crc_bitwise::crc32_update(CRC32_INIT, words[i], 300u);
+    crc[i] = CRC32_INIT;
+  }
+  for (uint32_t offset = 0u; offset < 300u; offset += 60u)
+  {
+    for (uint32_t i = 0u; i < 2u; i++)
+    {
+      crc[i] = crc_hw::crc32_update(crc[i], &words[i][offset], 60u);
+      CHECK(crc_bitwise::crc16_update(0u, data, 133u) == crc_hw::crc16_update(0u, data, 133u));
+    }
+  }
+  CHECK((expected[0] == crc[0]) && (expected[1] == crc[1]));
+
+  /* One image in pieces, as the flash writes go. */
+  crc[0] = CRC32_INIT;
+  for (uint32_t offset = 0u; offset < 300u; offset += 25u)
+  {
+    crc[0] = crc_hw::crc32_update(crc[0], &words[0][offset], 25u);
+  }
+  CHECK(expected[0] == crc[0]);
+  return 0;
+}
+
+int main(void)
+{
+  int failed = 0;
+
+  make_data();
+  crc_hw::crc_init();
+  failed |= crc16_engines();
+  failed |= crc32_engines();
+  CHECK(0u != host_crc_unit.bytes);
+  printf("CRC unit (%s): %u bytes, CRC-16 in %s\n", CRC_PROGRAMMABLE ? "programmable" : "fixed",
+         (unsigned)host_crc_unit.bytes, CRC_PROGRAMMABLE ? "the unit" : "software (nibble table)");
+  return failed;
+}
@@ -0,0 +1,490 @@
+/**
+ * @file    test_parsers.c
+ * @brief   Malformed and boundary input for the protocol parsers: the bounds
+ *          of the XMODEM extended commands, the error counter, and STK500 and
+ *          FrSky frames that must be refused without touching the flash.
+ */
+
+#include "xmodem.h"
+#include "stk500.h"
+#include "frsky.h"
+#include "flash.h"
+#include "crc.h"
+#include "host.h"
+#include "script.h"
+#include <stdio.h>
+#include <string.h>
+
+#define CHECK(cond)                                                   \
+  do                                                                  \
+  {                                                                   \
+    if (!(cond))                                                      \
+    {                                                                 \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+      return 1;                                                       \
+    }                                                                 \
+  } while (0)
+
+#define APP_SIZE (FLASH_APP_END_ADDRESS - FLASH_APP_START_ADDRESS + 1u)
+#define SEEK_UNIT ((FLASH_PAGE_SIZE > X_PACKET_1024_SIZE) ? FLASH_PAGE_SIZE : X_PACKET_1024_SIZE)
+
+static uint8_t input[0x2000];
+static uint32_t input_size;
+
+static void put(const void *data, uint32_t length)
+{
+  memcpy(&input[input_size], data, length);
+  input_size += length;
+}
+
+static void put_u8(uint8_t value)
+{
+  put(&value, 1u);
+}
+
+/* Nothing was written to the application area (the session page may be). */
+static int app_blank(void)
+{
+  const uint8_t *app = host_flash_mem(FLASH_APP_START_ADDRESS);
+  for (uint32_t i = 0u; i < APP_SIZE; i++)
+  {
+    if ((uint8_t)FLASH_ERASED_WORD != app[i])
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* XMODEM command frame, a wrong CRC if broken. */
+static void put_command(uint8_t id, const uint8_t *payload, uint16_t length, uint8_t broken)
+{
+  uint8_t header[X_CMD_HEADER_SIZE] = {id, (uint8_t)length, (uint8_t)(length >> 8u)};
+  uint16_t crc = crc16_update(crc16_update(0u, header, X_CMD_HEADER_SIZE), payload, length);
+  crc ^= broken ? 0x0100u : 0u;
+  put_u8(X_CMD);
+  put(header, sizeof(header));
+  put(payload, length);
+  put_u8((uint8_t)(crc >> 8u));
+  put_u8((uint8_t)crc);
+}
+
+/* Two little endian words, the payload of most commands. */
+static void put_command_2(uint8_t id, uint32_t first, uint32_t second)
+{
+  uint32_t payload[2] = {first, second};
+  put_command(id, (const uint8_t *)payload, sizeof(payload), 0u);
+}
+
+/* 128 byte XMODEM packet, a wrong CRC if broken. */
+static void put_packet(uint8_t number, const uint8_t *data, uint8_t broken)
+{
+  uint16_t crc = crc16_update(0u, data, X_PACKET_128_SIZE) ^ (broken ? 1u : 0u);
+  put_u8(X_SOH);
+  put_u8(number);
+  put_u8((uint8_t)~number);
+  put(data, X_PACKET_128_SIZE);
+  put_u8((uint8_t)(crc >> 8u));
+  put_u8((uint8_t)crc);
+}
+
+static int run_xmodem(void)
+{
+  script_start(input, input_size, 100u);
+  input_size = 0u;
+  return host_run(xmodem_receive);
+}
+
+/* Every refused command is answered with a single NAK. */
+static int xmodem_refused(void)
+{
+  static const struct
+  {
+    uint8_t id;
+    uint32_t first, second;
+  } words[] = {
+      {X_CMD_READ, FLASH_APP_START_ADDRESS, X_PACKET_1024_SIZE + 1u},   /* more than a packet */
+      {X_CMD_READ, FLASH_APP_START_ADDRESS, 0xFFFFFFFFu},
+      {X_CMD_READ, FLASH_BASE - 4u, 4u},                                 /* below the flash */
+      {X_CMD_READ, FLASH_BANK1_END - 3u, 8u},                            /* past the end */
+      {X_CMD_READ, 0xFFFFFFF0u, 0x20u},                                  /* wraps */
+      {X_CMD_CHECK, FLASH_APP_START_ADDRESS + 2u, 4u},                   /* unaligned */
+      {X_CMD_CHECK, FLASH_APP_START_ADDRESS, 6u},
+      {X_CMD_CHECK, FLASH_BANK1_END - 3u, 8u},
+      {X_CMD_SEEK, SEEK_UNIT / 2u, APP_SIZE},                            /* not a whole unit */
+      {X_CMD_SEEK, 0u, APP_SIZE + 1u},                                   /* bigger than the app */
+      {X_CMD_SEEK, 2u * SEEK_UNIT, SEEK_UNIT},                           /* size before the offset */
+      {X_CMD_SEEK, 0u, 0u},
+      {X_CMD_DELTA, 0u, 0u},                                             /* 8 of 14 bytes */
+  };
+  static const uint8_t short_payload[3] = {1u, 2u, 3u};
+
+  for (uint32_t i = 0u; i < (sizeof(words) / sizeof(words[0])); i++)
+  {
+    put_command_2(words[i].id, words[i].first, words[i].second);
+    CHECK(HOST_EXIT_IDLE == run_xmodem());
+    CHECK(X_NAK == script_out[0]);
+    CHECK(0 == script_check(HOST_EXIT_IDLE));
+  }
+
+  /* Broken frames: CRC, lengths, unknown id, oversize length. */
+  put_command(X_CMD_VERSION, short_payload, 3u, 1u);
+  CHECK(HOST_EXIT_IDLE == run_xmodem());
+  CHECK(X_NAK == script_out[0]);
+  put_command(X_CMD_VERSION, short_payload, 3u, 0u);
+  CHECK(HOST_EXIT_IDLE == run_xmodem());
+  CHECK(X_NAK == script_out[0]);
+  put_command(X_CMD_WINDOW, short_payload, 2u, 0u);
+  CHECK(HOST_EXIT_IDLE == run_xmodem());
+  CHECK(X_NAK == script_out[0]);
+  put_command(X_CMD_BAUD, short_payload, 3u, 0u);
+  CHECK(HOST_EXIT_IDLE == run_xmodem());
+  CHECK(X_NAK == script_out[0]);
+  put_command(X_CMD_CHECK, short_payload, 0u, 0u);
+  CHECK(HOST_EXIT_IDLE == run_xmodem());
+  CHECK(X_NAK == script_out[0]);
+  put_command(0x7Au, short_payload, 1u, 0u);
+  CHECK(HOST_EXIT_IDLE == run_xmodem());
+  CHECK(X_NAK == script_out[0]);
+  put_u8(X_CMD);
+  put_u8(X_CMD_READ);
+  put_u8((uint8_t)(X_PACKET_1024_SIZE + 1u));
+  put_u8((uint8_t)((X_PACKET_1024_SIZE + 1u) >> 8u));
+  CHECK(HOST_EXIT_IDLE == run_xmodem());
+  CHECK(X_NAK == script_out[0]);
+  CHECK(0 == script_check(HOST_EXIT_IDLE));
+  return 0;
+}
+
+/* The largest accepted ranges are answered with the flash content. */
+static int xmodem_accepted(void)
+{
+  uint32_t address = FLASH_BANK1_END + 1u - X_PACKET_1024_SIZE;
+
+  put_command_2(X_CMD_READ, address, X_PACKET_1024_SIZE);
+  CHECK(HOST_EXIT_IDLE == run_xmodem());
+  CHECK((6u + X_PACKET_1024_SIZE) <= script_out_size);
+  CHECK((X_ACK == script_out[0]) && (X_CMD_READ == script_out[1]));
+  CHECK(X_PACKET_1024_SIZE == (script_out[2] | (script_out[3] << 8)));
+  CHECK(0 == memcmp(&script_out[4], host_flash_mem(address), X_PACKET_1024_SIZE));
+
+  put_command_2(X_CMD_CHECK, FLASH_APP_START_ADDRESS, APP_SIZE);
+  CHECK(HOST_EXIT_IDLE == run_xmodem());
+  uint32_t crc = crc32_update(CRC32_INIT, (const uint32_t *)host_flash_mem(FLASH_APP_START_ADDRESS), APP_SIZE / 4u);
+  CHECK((X_ACK == script_out[0]) && (X_CMD_CHECK == script_out[1]) && (4u == script_out[2]));
+  CHECK(0 == memcmp(&script_out[4], &crc, 4u));
+  return 0;
+}
+
+static uint8_t packet[4][X_PACKET_128_SIZE];
+
+static void make_packets(void)
+{
+  uint32_t vectors[3] = {0x20005000u, FLASH_APP_START_ADDRESS + 0x101u, FLASH_APP_START_ADDRESS + 0x201u};
+  for (uint32_t i = 0u; i < sizeof(packet); i++)
+  {
+    packet[i / X_PACKET_128_SIZE][i % X_PACKET_128_SIZE] = (uint8_t)(i * 7u);
+  }
+  memcpy(packet[0], vectors, sizeof(vectors));
+}
+
+static uint32_t count(uint8_t value)
+{
+  uint32_t n = 0u;
+  for (uint32_t i = 0u; (i < script_out_size) && (i < SCRIPT_OUT_SIZE); i++)
+  {
+    n += (value == script_out[i]) ? 1u : 0u;
+  }
+  return n;
+}
+
+/* Only consecutive errors abort: one bad copy before every packet passes. */
+static int xmodem_errors(void)
+{
+  for (uint8_t i = 0u; i < 4u; i++)
+  {
+    put_packet(i + 1u, packet[i], 1u);
+    put_packet(i + 1u, packet[i], 0u);
+  }
+  put_u8(X_EOT);
+  CHECK(HOST_EXIT_START == run_xmodem());
+  CHECK(4u == count(X_NAK));
+  CHECK(0u == count(X_CAN));
+  CHECK(0 == memcmp(host_flash_mem(FLASH_APP_START_ADDRESS), packet, sizeof(packet)));
+
+  /* X_MAX_ERRORS in a row end the session, the image is not started. */
+  put_packet(1u, packet[0], 0u);
+  for (uint8_t i = 0u; i < X_MAX_ERRORS; i++)
+  {
+    put_packet(2u, packet[1], 1u);
+  }
+  put_packet(2u, packet[1], 0u);
+  put_u8(X_EOT);
+  int code = run_xmodem();
+  CHECK(HOST_EXIT_START != code);
+  CHECK(2u == count(X_CAN));
+  CHECK(0 == script_check(code));
+
+  /* A packet past the application area is refused by the flash (reported at
+   * the next frame, the write follows the ACK), the digest must not read
+   * beyond it. */
+  put_command_2(X_CMD_SEEK, APP_SIZE - SEEK_UNIT, APP_SIZE);
+  for (uint32_t i = 0u; i <= (SEEK_UNIT / X_PACKET_128_SIZE); i++)
+  {
+    put_packet((uint8_t)(i + 1u), packet[i % 4u], 0u);
+  }
+  put_u8(X_EOT);
+  code = run_xmodem();
+  CHECK(HOST_EXIT_START != code);
+  CHECK(2u == count(X_CAN));
+  CHECK(0 == script_check(code));
+
+  /* The window can't change once packets came. */
+  put_packet(1u, packet[0], 0u);
+  put_command(X_CMD_WINDOW, (const uint8_t *)"\x03", 1u, 0u);
+  code = run_xmodem();
+  CHECK((2u <= script_out_size) && (X_ACK == script_out[0]) && (X_NAK == script_out[1]));
+  CHECK(0 == script_check(code));
+  return 0;
+}
+
+static int8_t stk500_result;
+
+/* host_flash_bad_page of the next session */
+static uint32_t bad_page;
+
+static void run_stk500_entry(void)
+{
+  stk500_result = stk500_check();
+}
+
+static int run_stk500(void)
+{
+  script_start(input, input_size, 100u);
+  input_size = 0u;
+  host_boot_end = 0u;
+  host_flash_bad_page = bad_page;
+  bad_page = 0u;
+  return host_run(run_stk500_entry);
+}
+
+static int stk500_malformed(void)
+{
+  static const uint8_t sync[2] = {STK_GET_SYNC, CRC_EOP};
+  static uint8_t data[600];
+
+  /* Anything before GET_SYNC is not STK500. */
+  put_u8(STK_LOAD_ADDRESS);
+  put(sync, sizeof(sync));
+  CHECK(HOST_EXIT_RETURN == run_stk500());
+  CHECK((-1 == stk500_result) && (0u == script_out_size));
+
+  /* A page bigger than the buffer fails the upload before its data. */
+  put(sync, sizeof(sync));
+  put_u8(STK_PROG_PAGE);
+  put_u8((uint8_t)(sizeof(data) >> 8u));
+  put_u8((uint8_t)sizeof(data));
+  put_u8('F');
+  put(data, sizeof(data));
+  put_u8(CRC_EOP);
+  int code = run_stk500();
+  CHECK((HOST_EXIT_RETURN == code) && (-1 == stk500_result));
+  CHECK((3u == script_out_size) && (0 == memcmp(script_out, "\x14\x10\x11", 3u)));
+  CHECK((0u == host_flash_stats.programs) && (0u == host_flash_stats.erases));
+  CHECK(0 == script_check(code));
+
+  /* A page the line stops in ends at the first timeout, not after its
+   * length in timeouts. */
+  put(sync, sizeof(sync));
+  put_u8(STK_PROG_PAGE);
+  put_u8(1u);
+  put_u8(0u);
+  put_u8('F');
+  put(data, 100u);
+  code = run_stk500();
+  CHECK((HOST_EXIT_RETURN == code) && (-1 == stk500_result));
+  CHECK((3u == script_out_size) && (STK_FAILED == script_out[2]));
+  CHECK(host_time_ns < 1000000000u);
+  CHECK(0 == script_check(code));
+
+  /* A session that can't be started fails the pages, nothing is written. */
+  put(sync, sizeof(sync));
+  put_u8(STK_PROG_PAGE);
+  put_u8(0u);
+  put_u8(128u);
+  put_u8('F');
+  put(data, 128u);
+  put_u8(CRC_EOP);
+  put_u8(STK_LEAVE_PROGMODE);
+  put_u8(CRC_EOP);
+  bad_page = FLASH_SESSION_ADDRESS;
+  code = run_stk500();
+  CHECK((HOST_EXIT_RETURN == code) && (-1 == stk500_result));
+  CHECK((6u == script_out_size) && (0 == memcmp(script_out, "\x14\x10\x14\x11\x14\x11", 6u)));
+  CHECK((0u == host_flash_stats.programs) && app_blank());
+  CHECK(0 == script_check(code));
+
+  /* Pages past the application area are dropped, reads past the flash are
+   * padded. */
+  put(sync, sizeof(sync));
+  put_u8(STK_LOAD_ADDRESS);
+  put_u8(0xFFu);
+  put_u8(0xFFu);
+  put_u8(CRC_EOP);
+  put_u8(STK_PROG_PAGE);
+  put_u8(1u);
+  put_u8(0u);
+  put_u8('F');
+  put(data, 256u);
+  put_u8(CRC_EOP);
+  put_u8(STK_READ_PAGE);
+  put_u8(1u);
+  put_u8(0u);
+  put_u8('F');
+  put_u8(CRC_EOP);
+  code = run_stk500();
+  CHECK((8u + 256u) == script_out_size);
+  CHECK((STK_INSYNC == script_out[6]) && (STK_OK == script_out[7u + 256u]));
+  CHECK(0xFFu == script_out[6u + 256u]);
+  CHECK((0u == host_flash_stats.programs) && (0u == host_flash_stats.erases));
+  CHECK(0 == script_check(code));
+  return 0;
+}
+
+/* CRC of the frames, frsky.c */
+uint16_t crc16(const uint8_t *data_p, uint8_t length);
+
+/* FrSky request frame, a wrong CRC if broken. */
+static void put_frsky(uint8_t command, uint32_t word, uint8_t address, uint8_t broken)
+{
+  uint8_t frame[8] = {0x50u, command};
+  memcpy(&frame[2], &word, 4u);
+  frame[6] = address;
+  frame[7] = (uint8_t)crc16(frame, 7u) ^ (broken ? 1u : 0u);
+  put_u8(0x7Eu);
+  put_u8(0xFFu);
+  for (uint32_t i = 0u; i < sizeof(frame); i++)
+  {
+    if ((0x7Eu == frame[i]) || (0x7Du == frame[i]))
+    {
+      put_u8(0x7Du);
+      put_u8(frame[i] ^ 0x20u);
+    }
+    else
+    {
+      put_u8(frame[i]);
+    }
+  }
+}
+
+/* Commands of the answers sent, unstuffed. */
+static uint32_t frsky_answers(uint8_t *commands)
+{
+  uint32_t n = 0u;
+  for (uint32_t i = 0u; (i + 1u) < script_out_size;)
+  {
+    if ((0x7Eu != script_out[i]) || (0x5Eu != script_out[i + 1u]))
+    {
+      i++;
+      continue;
+    }
+    uint8_t frame[8];
+    uint32_t size = 0u;
+    for (i += 2u; (size < sizeof(frame)) && (i < script_out_size); size++)
+    {
+      uint8_t ch = script_out[i++];
+      frame[size] = ((0x7Du == ch) && (i < script_out_size)) ? (script_out[i++] ^ 0x20u) : ch;
+    }
+    commands[n++] = frame[1];
+  }
+  return n;
+}
+
+static void run_frsky_entry(void)
+{
+  (void)frsky_check();
+}
+
+static int run_frsky(void)
+{
+  script_start(input, input_size, 500u);
+  input_size = 0u;
+  host_boot_end = 0u;
+  host_flash_bad_page = bad_page;
+  bad_page = 0u;
+  return host_run(run_frsky_entry);
+}
+
+static int frsky_malformed(void)
+{
+  uint8_t answers[FLASH_PAGE_SIZE / 4u + 16u];
+
+  /* A broken frame is answered with DATA_CRC_ERR. */
+  put_frsky(0x00u, 0u, 0u, 0u);
+  put_frsky(0x01u, 0u, 0u, 1u);
+  int code = run_frsky();
+  CHECK(2u == frsky_answers(answers));
+  CHECK((0x80u == answers[0]) && (0x84u == answers[1]));
+  CHECK(0 == script_check(code));
+
+  /* Words with the wrong address are ignored, EOF ends the session. */
+  put_frsky(0x01u, 0u, 0u, 0u);
+  put_frsky(0x03u, 0u, 0u, 0u);
+  put_frsky(0x04u, 0x12345678u, 4u, 0u);
+  put_frsky(0x05u, 0u, 0u, 0u);
+  code = run_frsky();
+  CHECK(3u == frsky_answers(answers));
+  CHECK((0x81u == answers[0]) && (0x82u == answers[1]) && (0x83u == answers[2]));
+  CHECK(app_blank());
+  CHECK(0 == script_check(code));
+
+  /* EOF without a download */
+  put_frsky(0x05u, 0u, 0u, 0u);
+  code = run_frsky();
+  CHECK((1u == frsky_answers(answers)) && (0x83u == answers[0]));
+  CHECK(0 == script_check(code));
+
+  /* Words without a download (its frame was broken): a page of them with a
+   * vector table would leave a startable image without a session record. */
+  static const uint32_t vectors[3] = {0x20005000u, FLASH_APP_START_ADDRESS + 0x101u,
+                                      FLASH_APP_START_ADDRESS + 0x201u};
+  put_frsky(0x01u, 0u, 0u, 0u);
+  put_frsky(0x03u, 0u, 0u, 1u);
+  for (uint32_t offset = 0u; offset < (16u + FLASH_PAGE_SIZE); offset += 4u)
+  {
+    uint32_t index = (offset - 16u) / 4u;
+    put_frsky(0x04u, ((16u <= offset) && (index < 3u)) ? vectors[index] : offset, (uint8_t)offset, 0u);
+  }
+  put_frsky(0x05u, 0u, 0u, 0u);
+  code = run_frsky();
+  CHECK(3u == frsky_answers(answers));
+  CHECK((0x81u == answers[0]) && (0x84u == answers[1]) && (0x83u == answers[2]));
+  CHECK(app_blank());
+  CHECK(0 == script_check(code));
+
+  /* A download the session can't be started for is not answered. */
+  put_frsky(0x01u, 0u, 0u, 0u);
+  put_frsky(0x03u, 0u, 0u, 0u);
+  put_frsky(0x04u, 0x12345678u, 0u, 0u);
+  put_frsky(0x05u, 0u, 0u, 0u);
+  bad_page = FLASH_SESSION_ADDRESS;
+  code = run_frsky();
+  CHECK(2u == frsky_answers(answers));
+  CHECK((0x81u == answers[0]) && (0x83u == answers[1]));
+  CHECK((0u == host_flash_stats.programs) && app_blank());
+  CHECK(0 == script_check(code));
+  return 0;
+}
+
+int main(void)
+{
+  int failed = 0;
+
+  make_packets();
+  failed |= xmodem_refused();
+  failed |= xmodem_accepted();
+  failed |= xmodem_errors();
+  failed |= stk500_malformed();
+  failed |= frsky_malformed();
+  return failed;
+}
@@ -0,0 +1,81 @@
+/**
+ * @file    test_upload.c
+ * @brief   Plain XMODEM uploads into the simulated flash of one family.
+ */
+
+#include "xmodem.h"
+#include "host.h"
+#include "xmodem_peer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK(cond)                                                   \
+  do                                                                  \
+  {                                                                   \
+    if (!(cond))                                                      \
+    {                                                                 \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+      return 1;                                                       \
+    }                                                                 \
+  } while (0)
+
+static uint8_t image[24u * 1024u + 300u];
+
+/* Random image with a vector table flash_check_app_loaded() accepts. */
+static void make_image(uint32_t seed)
+{
+  srand(seed);
+  for (uint32_t i = 0u; i < sizeof(image); i++)
+  {
+    image[i] = (uint8_t)rand();
+  }
+  uint32_t vectors[3] = {0x20005000u, FLASH_APP_START_ADDRESS + 0x101u, FLASH_APP_START_ADDRESS + 0x201u};
+  memcpy(image, vectors, sizeof(vectors));
+}
+
+static int upload(uint16_t packet)
+{
+  xmodem_peer peer = {.image = image, .size = sizeof(image), .packet = packet, .reaction = 50u};
+
+  host_reset();
+  make_image(packet);
+  /* An older image is installed, its pages have to be erased. */
+  memset(host_flash_mem(FLASH_APP_START_ADDRESS), 0x5A, sizeof(image));
+  xmodem_peer_start(&peer);
+
+  CHECK(HOST_EXIT_START == host_run(xmodem_receive));
+  CHECK(peer.done);
+  CHECK(0u == peer.naks);
+  CHECK(0u == host_line_stats.dropped);
+  CHECK(0 == memcmp(host_flash_mem(FLASH_APP_START_ADDRESS), image, sizeof(image)));
+  CHECK(0 == flash_check_app_loaded());
+  printf("%u byte packets: %u bytes in %.1f ms, %u erases\n", packet, (unsigned)sizeof(image),
+         (double)host_time_ns / 1e6, (unsigned)host_flash_stats.erases);
+  return 0;
+}
+
+/* Once the session started, a broken upload leaves no startable image. */
+static int interrupted(void)
+{
+  xmodem_peer peer = {.image = image, .size = sizeof(image), .packet = X_PACKET_1024_SIZE,
+                      .reaction = 50u, .stop = 8u};
+
+  host_reset();
+  make_image(1u);
+  xmodem_peer_start(&peer);
+  /* The receiver gives up after X_MAX_ERRORS timeouts. */
+  CHECK(HOST_EXIT_RETURN == host_run(xmodem_receive));
+  CHECK(!peer.done);
+  CHECK(0 > flash_check_app_loaded());
+  return 0;
+}
+
+int main(void)
+{
+  int failed = 0;
+  failed |= upload(X_PACKET_128_SIZE);
+  failed |= upload(X_PACKET_1024_SIZE);
+  failed |= interrupted();
+  return failed;
+}
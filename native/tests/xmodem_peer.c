@@ -0,0 +1,265 @@
+/**
+ * @file    xmodem_peer.c
+ * @brief   Uploading side of XMODEM for the host tests: plain or windowed
+ *          XMODEM(-1K), the window is negotiated with X_CMD_WINDOW.
+ */
+
+#include "xmodem_peer.h"
+#include "xmodem.h"
+#include "crc.h"
+#include "host.h"
+#include <string.h>
+
+#define PEER_PAD 0x1Au
+
+enum
+{
+  PEER_WAIT_C,
+  PEER_WAIT_FRAME, /**< Answer of X_CMD_WINDOW. */
+  PEER_SENDING,
+  PEER_WAIT_EOT,
+  PEER_DONE
+};
+
+static xmodem_peer *peer;
+static uint8_t peer_state;
+static uint32_t peer_base;    /**< First packet not acknowledged. */
+static uint32_t peer_next;    /**< Next packet to send. */
+static uint32_t peer_count;   /**< Packets of the image. */
+static uint8_t peer_window;   /**< Packets in flight. */
+static uint8_t peer_reply;    /**< ACK/NAK waiting for its packet number. */
+static uint8_t peer_frame[16u]; /**< Answer frame collected so far. */
+static uint16_t peer_frame_size;
+
+static void peer_send_packet(uint32_t index)
+{
+  uint8_t frame[3u + X_PACKET_1024_SIZE + 2u];
+  uint32_t offset = index * peer->packet;
+  uint32_t length = peer->size - offset;
+  uint16_t crc;
+
+  if (length > peer->packet)
+  {
+    length = peer->packet;
+  }
+  frame[0] = (X_PACKET_1024_SIZE == peer->packet) ? X_STX : X_SOH;
+  frame[1] = (uint8_t)(index + 1u);
+  frame[2] = (uint8_t)~frame[1];
+  memset(&frame[3], PEER_PAD, peer->packet);
+  memcpy(&frame[3], &peer->image[offset], length);
+  crc = crc16_update(0u, &frame[3], peer->packet);
+  frame[3u + peer->packet] = (uint8_t)(crc >> 8u);
+  frame[4u + peer->packet] = (uint8_t)crc;
+  if (0u == peer->start_ns)
+  {
+    peer->start_ns = host_time_ns;
+  }
+  host_uart_feed_after(peer->reaction, frame, 5u + peer->packet);
+}
+
+static void peer_send_command(uint8_t id, const uint8_t *payload, uint16_t length)
+{
+  uint8_t frame[1u + X_CMD_HEADER_SIZE + 8u + 2u] = {X_CMD, id, (uint8_t)length, (uint8_t)(length >> 8u)};
+  uint16_t crc;
+
+  memcpy(&frame[4u], payload, length);
+  crc = crc16_update(0u, &frame[1u], X_CMD_HEADER_SIZE + length);
+  frame[4u + length] = (uint8_t)(crc >> 8u);
+  frame[5u + length] = (uint8_t)crc;
+  peer->start_ns = host_time_ns;
+  host_uart_feed_after(peer->reaction, frame, 6u + length);
+}
+
+/* Keeps the window full, EOT once everything is acknowledged. */
+static void peer_fill(void)
+{
+  while ((peer_next < peer_count) && (peer_next < (peer_base + peer_window)) &&
+         !(peer->stop && (peer_next >= peer->stop)))
+  {
+    peer_send_packet(peer_next++);
+  }
+  if (peer_base >= peer_count)
+  {
+    uint8_t eot = X_EOT;
+    host_uart_feed_after(peer->reaction, &eot, 1u);
+    peer_state = PEER_WAIT_EOT;
+  }
+}
+
+/* Index of a packet number within the window. */
+static uint32_t peer_index(uint8_t number)
+{
+  return peer_base + (uint8_t)(number - (uint8_t)(peer_base + 1u));
+}
+
+/* Collects an answer frame, returns its id once complete (0 if broken). */
+static int peer_collect(uint8_t ch)
+{
+  peer_frame[peer_frame_size++] = ch;
+  if ((1u == peer_frame_size) && (X_ACK != ch))
+  {
+    peer_frame_size = 0u;
+    return 0;
+  }
+  if (peer_frame_size < 4u)
+  {
+    return -1;
+  }
+  uint16_t length = (uint16_t)peer_frame[2u] | ((uint16_t)peer_frame[3u] << 8u);
+  if ((length + 6u) > sizeof(peer_frame))
+  {
+    peer_frame_size = 0u;
+    return 0;
+  }
+  if (peer_frame_size < (length + 6u))
+  {
+    return -1;
+  }
+  peer_frame_size = 0u;
+  uint16_t crc = crc16_update(0u, &peer_frame[1u], X_CMD_HEADER_SIZE + length);
+  if (crc != (((uint16_t)peer_frame[4u + length] << 8u) | peer_frame[5u + length]))
+  {
+    return 0;
+  }
+  return peer_frame[1u];
+}
+
+static void peer_answer(uint8_t ch)
+{
+  if (1u == peer_window)
+  {
+    if (X_ACK == ch)
+    {
+      peer_base++;
+      peer_fill();
+    }
+    else if (X_NAK == ch)
+    {
+      peer->naks++;
+      peer_next = peer_base;
+      peer_fill();
+    }
+    return;
+  }
+  if (0u == peer_reply)
+  {
+    if ((X_ACK == ch) || (X_NAK == ch))
+    {
+      peer_reply = ch;
+    }
+    return;
+  }
+  uint32_t index = peer_index(ch);
+  if (X_ACK == peer_reply)
+  {
+    /* Cumulative, up to and including the packet. */
+    if (index < peer_next)
+    {
+      peer_base = index + 1u;
+    }
+  }
+  else
+  {
+    peer->naks++;
+    if (index <= peer_next)
+    {
+      peer_base = index;
+      peer_next = index;
+    }
+  }
+  peer_reply = 0u;
+  peer_fill();
+}
+
+static void peer_receive(const uint8_t *data, uint32_t length)
+{
+  while (length--)
+  {
+    uint8_t ch = *data++;
+    int id;
+    switch (peer_state)
+    {
+    case PEER_WAIT_C:
+      if (X_C != ch)
+      {
+        break;
+      }
+      if (1u < peer->window)
+      {
+        peer_send_command(X_CMD_WINDOW, &peer->window, 1u);
+        peer_state = PEER_WAIT_FRAME;
+      }
+      else
+      {
+        peer_state = PEER_SENDING;
+        peer_fill();
+      }
+      break;
+    case PEER_WAIT_FRAME:
+      id = peer_collect(ch);
+      if (X_CMD_WINDOW == id)
+      {
+        peer_window = peer_frame[4u];
+        peer->extended = 1u;
+        peer_state = PEER_SENDING;
+        peer_fill();
+      }
+      else if (0 == id)
+      {
+        /* Refused, plain XMODEM. */
+        peer_state = PEER_SENDING;
+        peer_fill();
+      }
+      break;
+    case PEER_SENDING:
+      peer_answer(ch);
+      break;
+    case PEER_WAIT_EOT:
+      if (!peer->extended)
+      {
+        if (X_ACK == ch)
+        {
+          peer->done = 1u;
+          peer->end_ns = host_time_ns;
+          peer_state = PEER_DONE;
+        }
+        break;
+      }
+      /* Late window replies come before the digest. */
+      if ((0u == peer_frame_size) && (X_ACK != ch))
+      {
+        break;
+      }
+      id = peer_collect(ch);
+      if (X_EOT_DIGEST == id)
+      {
+        memcpy(&peer->digest_size, &peer_frame[4u], 4u);
+        memcpy(&peer->digest_crc, &peer_frame[8u], 4u);
+        peer->done = 1u;
+        peer->end_ns = host_time_ns;
+        peer_state = PEER_DONE;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+void xmodem_peer_start(xmodem_peer *config)
+{
+  peer = config;
+  peer->done = 0u;
+  peer->extended = 0u;
+  peer->naks = 0u;
+  peer->start_ns = 0u;
+  peer->end_ns = 0u;
+  peer_state = PEER_WAIT_C;
+  peer_base = 0u;
+  peer_next = 0u;
+  peer_count = (peer->size + peer->packet - 1u) / peer->packet;
+  peer_window = 1u;
+  peer_reply = 0u;
+  peer_frame_size = 0u;
+  host_uart_peer = peer_receive;
+}
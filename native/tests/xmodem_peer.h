@@ -0,0 +1,32 @@
+/**
+ * @file    xmodem_peer.h
+ * @brief   Uploading side of XMODEM for the host tests, runs as the UART
+ *          peer of the simulation (host_uart_peer).
+ */
+
+#ifndef XMODEM_PEER_H_
+#define XMODEM_PEER_H_
+
+#include <stdint.h>
+
+typedef struct
+{
+  const uint8_t *image;
+  uint32_t size;
+  uint16_t packet;    /**< 128 or 1024 bytes. */
+  uint32_t reaction;  /**< us until the host answers. */
+  uint32_t stop;      /**< Goes silent after this many packets, 0 never. */
+  uint8_t window;     /**< Asks for windowed mode if more than 1. */
+  /* Results */
+  uint8_t done;       /**< EOT was acknowledged. */
+  uint8_t extended;   /**< Negotiated the window, EOT has a digest. */
+  uint32_t naks;
+  uint32_t digest_size;
+  uint32_t digest_crc;
+  uint64_t start_ns;  /**< First byte sent. */
+  uint64_t end_ns;    /**< EOT acknowledged. */
+} xmodem_peer;
+
+void xmodem_peer_start(xmodem_peer *peer);
+
+#endif /* XMODEM_PEER_H_ */
@@ -0,0 +1,634 @@
+#!/usr/bin/env python3
+#
+# Host side uploader for the XMODEM bootloader builds.
+#
+# Speaks plain XMODEM-1K (CRC-16) and the extended commands of Src/xmodem.h.
+#
+# Usage:
+#   python3 xmodem_upload.py -p /dev/ttyUSB0 -b 420000 [-w 3] [-z] [--old installed.bin] firmware.bin
+#
+import argparse
+import bisect
+import struct
+import sys
+import time
+import zlib
+
+import serial
+
+SOH = 0x01
+STX = 0x02
+EOT = 0x04
+ACK = 0x06
+NAK = 0x15
+CAN = 0x18
+C = 0x43
+CMD = 0x05
+
+CMD_WINDOW = ord('W')
+CMD_COMPRESS = ord('Z')
+CMD_DELTA = ord('D')
+CMD_RESUME = ord('R')
+CMD_BAUD = ord('B')
+CMD_STATS = ord('S')
+CMD_VERSION = ord('V')
+EOT_DIGEST = ord('E')
+CMD_READ = ord('F')
+CMD_CHECK = ord('K')
+CMD_INFO = ord('P')
+CMD_SEEK = ord('A')
+CHECK_CHUNK = 4096
+STATS_FIELDS = ("elapsed", "packets", "errors", "received", "written",
+                "flash_time", "baud", "stack", "kept", "blank")
+
+BAUD_PROBE = bytes([0x55, 0xAA, 0x0F, 0xF0])
+BAUD_PROBE_TIMEOUT = 0.5
+
+DELTA_OP_COPY = 0x01
+DELTA_OP_LITERAL = 0x02
+DELTA_MIN_COPY = 12
+
+PACKET_SIZE = 1024
+PAD = 0x1A
+MAX_ERRORS = 10
+
+
+def _crc16_table():
+    table = []
+    for i in range(256):
+        crc = i << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+        table.append(crc & 0xFFFF)
+    return table
+
+
+CRC16_TABLE = _crc16_table()
+
+
+def crc16(data, crc=0):
+    for byte in data:
+        crc = ((crc << 8) & 0xFFFF) ^ CRC16_TABLE[(crc >> 8) ^ byte]
+    return crc
+
+
+def _crc32_table():
+    table = []
+    for byte in range(256):
+        crc = byte << 24
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x04C11DB7) if crc & 0x80000000 else (crc << 1)
+        table.append(crc & 0xFFFFFFFF)
+    return table
+
+
+CRC32_TABLE = _crc32_table()
+
+
+def crc32_words(data, crc=0xFFFFFFFF):
+    """CRC-32/MPEG-2 over little endian words, as the receiver's CRC unit."""
+    for offset in range(0, len(data), 4):
+        # The unit shifts in the most significant byte of the word first
+        for byte in reversed(data[offset:offset + 4]):
+            crc = ((crc << 8) & 0xFFFFFFFF) ^ CRC32_TABLE[(crc >> 24) ^ byte]
+    return crc
+
+
+def lzss_compress(data, window_bits=8, lookahead_bits=4):
+    """Greedy LZSS in the heatshrink bit format, see Src/lzss.h."""
+    window = 1 << window_bits
+    max_len = 1 << lookahead_bits
+    # A back reference has to be cheaper than literals (9 bits each)
+    min_len = (1 + window_bits + lookahead_bits) // 9 + 1
+    chains = {}
+    out = bytearray()
+    acc = 0
+    acc_bits = 0
+
+    def put(value, bits):
+        nonlocal acc, acc_bits
+        acc = (acc << bits) | value
+        acc_bits += bits
+        while acc_bits >= 8:
+            acc_bits -= 8
+            out.append((acc >> acc_bits) & 0xFF)
+        acc &= (1 << acc_bits) - 1
+
+    pos = 0
+    while pos < len(data):
+        best_len = 0
+        best_dist = 0
+        key = data[pos:pos + 2]
+        for cand in reversed(chains.get(key, ())):
+            dist = pos - cand
+            if dist > window:
+                break
+            length = 0
+            while (length < max_len and pos + length < len(data) and
+                   data[cand + length] == data[pos + length]):
+                length += 1
+            if length > best_len:
+                best_len = length
+                best_dist = dist
+                if length == max_len:
+                    break
+        if best_len >= min_len:
+            put(0, 1)
+            put(best_dist - 1, window_bits)
+            put(best_len - 1, lookahead_bits)
+            step = best_len
+        else:
+            put(0x100 | data[pos], 9)
+            step = 1
+        for i in range(pos, pos + step):
+            chains.setdefault(data[i:i + 2], []).append(i)
+        pos += step
+    if acc_bits:
+        out.append((acc << (8 - acc_bits)) & 0xFF)
+    return bytes(out)
+
+
+def make_patch(old, new, page_size):
+    """Patch stream of Src/delta.h, safe to apply in place page by page."""
+    key_len = 8
+    index = {}
+    for i in range(len(old) - key_len + 1):
+        index.setdefault(old[i:i + key_len], []).append(i)
+
+    out = bytearray()
+    literal = bytearray()
+
+    def flush_literal():
+        for i in range(0, len(literal), 0xFFFF):
+            chunk = literal[i:i + 0xFFFF]
+            out.extend(struct.pack("<BH", DELTA_OP_LITERAL, len(chunk)))
+            out.extend(chunk)
+        literal.clear()
+
+    pos = 0
+    while pos < len(new):
+        page_start = pos - pos % page_size
+        best_len = 0
+        best_src = 0
+        cands = index.get(new[pos:pos + key_len], [])
+        # Pages before the current one are rewritten already
+        first = bisect.bisect_left(cands, page_start)
+        for src in cands[first:first + 64]:
+            limit = min(len(new) - pos, len(old) - src, 0xFFFF)
+            if src < pos:
+                # The source page is rewritten when the output leaves it
+                limit = min(limit, page_start + page_size - pos)
+            length = 0
+            while (length + 64 <= limit and
+                   new[pos + length:pos + length + 64] ==
+                   old[src + length:src + length + 64]):
+                length += 64
+            while length < limit and new[pos + length] == old[src + length]:
+                length += 1
+            if length > best_len:
+                best_len = length
+                best_src = src
+                if length == limit:
+                    break
+        if best_len >= DELTA_MIN_COPY:
+            flush_literal()
+            out.extend(struct.pack("<BI", DELTA_OP_COPY, best_src)[:4])
+            out.extend(struct.pack("<H", best_len))
+            pos += best_len
+        else:
+            literal.append(new[pos])
+            pos += 1
+    flush_literal()
+    return bytes(out)
+
+
+class BootloaderError(Exception):
+    pass
+
+
+class Bootloader:
+    def __init__(self, port, baud, timeout=2.0):
+        self.ser = serial.Serial(port, baud, timeout=timeout)
+        self.timeout = timeout
+        # The receiver sends the EOT digest once it took a command
+        self.extended = False
+
+    def close(self):
+        self.ser.close()
+
+    def read(self, count, timeout=None):
+        self.ser.timeout = self.timeout if timeout is None else timeout
+        data = self.ser.read(count)
+        if len(data) != count:
+            raise BootloaderError("timeout")
+        return data
+
+    def handshake(self, wait=10.0):
+        """Request the bootloader and wait until the receiver polls with 'C'."""
+        end = time.time() + wait
+        while time.time() < end:
+            self.ser.write(b"bbb")
+            self.ser.timeout = 0.5
+            if C in self.ser.read(256):
+                break
+        else:
+            raise BootloaderError("no response from the bootloader")
+        # Stray magic bytes may have restarted the receiver, wait for a fresh 'C'
+        self.ser.reset_input_buffer()
+        self.ser.timeout = 3.0
+        if C not in self.ser.read(1):
+            raise BootloaderError("receiver not ready")
+
+    def _read_ack(self, timeout=None):
+        """Return the next ACK/NAK/CAN, skip anything else (e.g. 'C' polling)."""
+        end = time.time() + (self.timeout if timeout is None else timeout)
+        while time.time() < end:
+            self.ser.timeout = max(end - time.time(), 0.001)
+            data = self.ser.read(1)
+            if data and data[0] in (ACK, NAK, CAN):
+                return data[0]
+        return None
+
+    def command(self, cid, payload=b""):
+        """Send an extended command frame and return the answer payload."""
+        header = struct.pack("<BH", cid, len(payload))
+        crc = crc16(payload, crc16(header))
+        self.ser.write(bytes([CMD]) + header + payload + struct.pack(">H", crc))
+        if self._read_ack() != ACK:
+            raise BootloaderError("command 0x%02X refused" % cid)
+        answer = self._read_answer(cid)
+        self.extended = True
+        return answer
+
+    def _read_answer(self, cid):
+        """Rest of an answer frame after its ACK."""
+        header = self.read(3)
+        rid, length = struct.unpack("<BH", header)
+        payload = self.read(length) if length else b""
+        crc = struct.unpack(">H", self.read(2))[0]
+        if rid != cid or crc != crc16(payload, crc16(header)):
+            raise BootloaderError("broken answer to command 0x%02X" % cid)
+        return payload
+
+    def negotiate_window(self, window):
+        return self.command(CMD_WINDOW, bytes([window]))[0]
+
+    def negotiate_baud(self, rates):
+        """Move to the first rate both sides can do, return the rate in use."""
+        rates = list(rates)
+        while rates:
+            payload = b"".join(struct.pack("<I", rate) for rate in rates)
+            reply = self.command(CMD_BAUD, payload)
+            rate = struct.unpack("<I", reply)[0]
+            if not rate:
+                break
+            old = self.ser.baudrate
+            time.sleep(0.02)
+            self.ser.baudrate = rate
+            self.ser.reset_input_buffer()
+            self.ser.write(BAUD_PROBE)
+            self.ser.timeout = BAUD_PROBE_TIMEOUT
+            if self.ser.read(len(BAUD_PROBE)) == BAUD_PROBE:
+                return rate
+            # The receiver falls back once the probe timed out
+            self.ser.baudrate = old
+            time.sleep(BAUD_PROBE_TIMEOUT + 0.1)
+            self.ser.reset_input_buffer()
+            rates.remove(rate)
+        return self.ser.baudrate
+
+    def resume(self, image):
+        """Offset the receiver already holds of an interrupted upload."""
+        ident = zlib.crc32(image) & 0xFFFFFFFF
+        reply = self.command(CMD_RESUME, struct.pack("<II", len(image), ident))
+        return struct.unpack("<I", reply)[0]
+
+    def read_flash(self, address, length, progress=None):
+        """Read a flash range in answer sized pieces."""
+        out = b""
+        while len(out) < length:
+            size = min(PACKET_SIZE, length - len(out))
+            out += self.command(CMD_READ,
+                                struct.pack("<II", address + len(out), size))
+            if progress:
+                progress(len(out), length)
+        return out
+
+    def checksums(self, ranges):
+        """CRC-32 (see crc32_words) of each (address, length) range."""
+        out = []
+        # 128 ranges fill the command payload
+        for i in range(0, len(ranges), PACKET_SIZE // 8):
+            part = ranges[i:i + PACKET_SIZE // 8]
+            reply = self.command(CMD_CHECK, b"".join(
+                struct.pack("<II", address, length) for address, length in part))
+            out += struct.unpack("<%uI" % len(part), reply)
+        return out
+
+    def verify(self, address, image):
+        """Offsets of the chunks that differ from the flash."""
+        words = len(image) & ~3
+        ranges = [(address + offset, min(CHECK_CHUNK, words - offset))
+                  for offset in range(0, words, CHECK_CHUNK)]
+        bad = [offset - address for (offset, length), crc in
+               zip(ranges, self.checksums(ranges))
+               if crc != crc32_words(image[offset - address:
+                                           offset - address + length])]
+        if words != len(image) and \
+                self.read_flash(address + words, len(image) - words) != image[words:]:
+            bad.append(words & ~(CHECK_CHUNK - 1))
+        return bad
+
+    def info(self):
+        """Page size, application address and size."""
+        return struct.unpack("<III", self.command(CMD_INFO))
+
+    def changed_units(self, image):
+        """Offsets of the units (whole packets and pages) of the padded image
+        that differ from the flash, and the unit size."""
+        page, address, _ = self.info()
+        unit = max(page, PACKET_SIZE)
+        padded = image.ljust(-(-len(image) // PACKET_SIZE) * PACKET_SIZE,
+                             bytes([PAD]))
+        # A page behind the last packet stays erased
+        padded = padded.ljust(-(-len(padded) // unit) * unit, b"\xFF")
+        offsets = list(range(0, len(padded), unit))
+        crcs = self.checksums([(address + offset, unit) for offset in offsets])
+        return [offset for offset, crc in zip(offsets, crcs)
+                if crc != crc32_words(padded[offset:offset + unit])], unit
+
+    def send_changed(self, image, progress=None, stats=False):
+        """Send only the units that differ, see send() for the result. The
+        third value is the number of bytes sent."""
+        changed, unit = self.changed_units(image)
+        if not changed:
+            # Nothing to write, EOT starts the application
+            return self._finish(stats)[0], None, 0
+        size = -(-len(image) // PACKET_SIZE) * PACKET_SIZE
+        packets = self.packets(image)
+        per_unit = unit // PACKET_SIZE
+        # Packet numbers run on over the gaps
+        number = 0
+        done = 0
+        for index, offset in enumerate(changed):
+            if index == 0 or changed[index - 1] + unit != offset:
+                self.command(CMD_SEEK, struct.pack("<II", offset, size))
+            first = offset // PACKET_SIZE
+            run = []
+            for data in packets[first:first + per_unit]:
+                number = (number + 1) & 0xFF
+                run.append(bytes([STX, number, 0xFF - number]) + data[3:])
+            self._send_plain(run, None)
+            done += 1
+            if progress:
+                progress(done, len(changed))
+        return self._finish(stats) + (len(changed) * unit,)
+
+    def version(self, version):
+        """Version stored with the image descriptor."""
+        self.command(CMD_VERSION, struct.pack("<I", version))
+
+    def delta(self, old, image):
+        """Announce a patch against the installed image, return the patch."""
+        info = struct.pack("<IIH", len(image), len(old), crc16(old))
+        # The patch depends on the page size, ask first with an empty patch
+        reply = self.command(CMD_DELTA, struct.pack("<I", 0) + info)
+        patch = make_patch(old, image, struct.unpack("<H", reply)[0])
+        self.command(CMD_DELTA, struct.pack("<I", len(patch)) + info)
+        return patch
+
+    def compress(self, image):
+        """Announce a compressed upload, return the stream to send."""
+        # Parameters are fixed per build, ask first with an empty image
+        params = self.command(CMD_COMPRESS, struct.pack("<II", 0, 0))
+        stream = lzss_compress(image, params[0], params[1])
+        self.command(CMD_COMPRESS, struct.pack("<II", len(stream), len(image)))
+        return stream
+
+    @staticmethod
+    def packets(image):
+        out = []
+        for index, offset in enumerate(range(0, len(image), PACKET_SIZE)):
+            data = image[offset:offset + PACKET_SIZE]
+            data += bytes([PAD]) * (PACKET_SIZE - len(data))
+            number = (index + 1) & 0xFF
+            out.append(bytes([STX, number, 0xFF - number]) + data +
+                       struct.pack(">H", crc16(data)))
+        return out
+
+    def stats(self):
+        reply = self.command(CMD_STATS)
+        return dict(zip(STATS_FIELDS, struct.unpack("<%uI" % len(STATS_FIELDS),
+                                                    reply)))
+
+    def send(self, image, window=1, progress=None, stats=False):
+        """Send the image, return the receiver statistics if asked for and
+        the (size, CRC-32) of the image in the flash, None if not reported."""
+        if window > 1:
+            self._send_windowed(self.packets(image), window, progress)
+        else:
+            self._send_plain(self.packets(image), progress)
+        return self._finish(stats)
+
+    def _finish(self, stats):
+        # Ask before EOT, the receiver starts the application afterwards
+        report = self.stats() if stats else None
+        self.ser.write(bytes([EOT]))
+        if self._read_ack() != ACK:
+            raise BootloaderError("EOT not acknowledged")
+        digest = None
+        if self.extended:
+            digest = struct.unpack("<II", self._read_answer(EOT_DIGEST))
+        return report, digest
+
+    def _send_plain(self, packets, progress):
+        errors = 0
+        index = 0
+        while index < len(packets):
+            self.ser.write(packets[index])
+            reply = self._read_ack()
+            if reply == ACK:
+                index += 1
+                if progress:
+                    progress(index, len(packets))
+                continue
+            if reply == CAN:
+                raise BootloaderError("cancelled by the bootloader")
+            errors += 1
+            if errors >= MAX_ERRORS:
+                raise BootloaderError("too many errors")
+
+    def _send_windowed(self, packets, window, progress):
+        # Packet index i carries the number (i + 1) & 0xFF
+        errors = 0
+        base = 0
+        sent = 0
+        while base < len(packets):
+            while sent < len(packets) and sent - base < window:
+                self.ser.write(packets[sent])
+                sent += 1
+            reply = self._read_ack()
+            if reply is None:
+                # Lost answer, go back to the oldest unacknowledged packet
+                errors += 1
+                sent = base
+            elif reply == CAN:
+                raise BootloaderError("cancelled by the bootloader")
+            else:
+                number = self.read(1)[0]
+                if reply == ACK:
+                    acked = base - 1 + ((number - base) & 0xFF)
+                    if acked < sent:
+                        base = acked + 1
+                        if progress:
+                            progress(base, len(packets))
+                else:
+                    expected = base + ((number - base - 1) & 0xFF)
+                    if expected <= sent:
+                        base = expected
+                    sent = base
+                    errors += 1
+            if errors >= MAX_ERRORS:
+                raise BootloaderError("too many errors")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="XMODEM bootloader uploader")
+    parser.add_argument("-p", "--port", required=True)
+    parser.add_argument("-b", "--baud", type=int, default=420000)
+    parser.add_argument("-s", "--speed", default="",
+                        help="comma separated baud rates to try after the "
+                             "handshake, fastest first")
+    parser.add_argument("-w", "--window", type=int, default=1,
+                        help="packets in flight (windowed mode)")
+    parser.add_argument("-z", "--compress", action="store_true",
+                        help="send the image LZSS compressed")
+    parser.add_argument("--old",
+                        help="installed image, send a patch against it")
+    parser.add_argument("--no-resume", action="store_true",
+                        help="always send the whole image")
+    parser.add_argument("--changed", action="store_true",
+                        help="only send the pages that differ from the flash "
+                             "(plain packets)")
+    parser.add_argument("--stats", action="store_true",
+                        help="print the receiver's throughput report")
+    parser.add_argument("--image-version", type=lambda v: int(v, 0),
+                        help="version number stored with the image")
+    parser.add_argument("-a", "--address", type=lambda v: int(v, 0),
+                        help="flash address of the application, for "
+                             "--verify and --backup")
+    parser.add_argument("--verify", action="store_true",
+                        help="only compare the image with the flash")
+    parser.add_argument("--backup", type=int, metavar="LENGTH",
+                        help="read LENGTH bytes of the flash into the "
+                             "firmware file instead of writing it")
+    parser.add_argument("--no-handshake", action="store_true",
+                        help="the receiver is already polling with 'C'")
+    parser.add_argument("firmware")
+    args = parser.parse_args()
+    if (args.verify or args.backup) and args.address is None:
+        parser.error("--verify and --backup need --address")
+    if args.changed and (args.old or args.compress or args.window > 1):
+        parser.error("--changed can't be combined with --old, -z or -w")
+
+    image = b""
+    if not args.backup:
+        with open(args.firmware, "rb") as f:
+            image = f.read()
+
+    bl = Bootloader(args.port, args.baud)
+    try:
+        if not args.no_handshake:
+            bl.handshake()
+        if args.speed:
+            rates = [int(rate) for rate in args.speed.split(",")]
+            print("Baud rate: %u" % bl.negotiate_baud(rates))
+        window = 1
+        if args.window > 1:
+            window = bl.negotiate_window(args.window)
+            print("Window: %u" % window)
+
+        def progress(done, total):
+            sys.stdout.write("\r%3u%%" % (100 * done // total))
+            sys.stdout.flush()
+
+        if args.backup:
+            data = bl.read_flash(args.address, args.backup, progress)
+            with open(args.firmware, "wb") as f:
+                f.write(data)
+            print("\nRead %u bytes" % len(data))
+            return 0
+        if args.verify:
+            bad = bl.verify(args.address, image)
+            for offset in bad:
+                print("Differs at 0x%08X" % (args.address + offset))
+            print("Flash %s the image" % ("differs from" if bad else "matches"))
+            return 1 if bad else 0
+
+        if args.image_version is not None:
+            bl.version(args.image_version)
+        payload = image
+        if not (args.old or args.compress or args.no_resume or args.changed):
+            offset = bl.resume(image)
+            if offset:
+                print("Resuming at offset %u" % offset)
+                payload = image[offset:]
+        if args.old:
+            with open(args.old, "rb") as f:
+                payload = bl.delta(f.read(), image)
+            print("Patch: %u -> %u bytes (%.1f%%)" %
+                  (len(image), len(payload), 100.0 * len(payload) / len(image)))
+        if args.compress:
+            payload = bl.compress(payload)
+            print("Compressed: %u -> %u bytes (%.1f%%)" %
+                  (len(image), len(payload), 100.0 * len(payload) / len(image)))
+
+        start = time.time()
+        if args.changed:
+            report, digest, sent = bl.send_changed(image, progress, args.stats)
+            if not sent:
+                print("Flash already holds the image")
+        else:
+            report, digest = bl.send(payload, window, progress, args.stats)
+            sent = len(payload)
+        elapsed = time.time() - start
+        print("\nSent %u bytes in %.2f s (%.0f bytes/s, %.0f image bytes/s)" %
+              (sent, elapsed, sent / elapsed, len(image) / elapsed))
+        if digest:
+            size, crc = digest
+            # Plain packets are padded with PAD, decoded images with the
+            # erased flash value (0x00 on L0)
+            pads = (0xFF, 0x00) if (args.old or args.compress) else (PAD,)
+            words = (size + 3) & ~3
+            if size >= len(image) and any(
+                    crc32_words(image.ljust(words, bytes([pad]))) == crc
+                    for pad in pads):
+                print("Flash content verified (CRC-32 0x%08X)" % crc)
+            else:
+                print("Flash content does NOT match the image!")
+                return 1
+        if report:
+            line_rate = report["baud"] / 10.0
+            device_time = max(report["elapsed"], 1) / 1000.0
+            print("Receiver: %u packets, %u errors, %u bytes in %.2f s" %
+                  (report["packets"], report["errors"], report["received"],
+                   device_time))
+            print("  %.0f bytes/s of %.0f line rate (%.0f%%), %u bytes "
+                  "written, flash busy %.0f%%" %
+                  (report["received"] / device_time, line_rate,
+                   100.0 * report["received"] / device_time / line_rate,
+                   report["written"],
+                   100.0 * report["flash_time"] / 1000.0 / device_time))
+            print("  pages unchanged %u, written without erase %u" %
+                  (report["kept"], report["blank"]))
+            print("  peak stack use %u bytes" % report["stack"])
+    except BootloaderError as err:
+        print("\nUpload failed: %s" % err)
+        return 1
+    finally:
+        bl.close()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())